@@ -0,0 +1,185 @@
+#include "bit_packing.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BIT_PACKING_SSE2
+#endif
+
+using namespace std;
+
+namespace
+{
+	const size_t LANE_COUNT = 4;
+	const size_t LANE_SIZE = BIT_PACKING_BLOCK_SIZE / LANE_COUNT;
+
+	uint32_t GetMask(uint32_t bit_width)
+	{
+		return bit_width == 32 ? ~0u : (1u << bit_width) - 1;
+	}
+
+	// Packs count values taken every stride positions into words written every stride positions
+	void PackStrided(const uint32_t* values, size_t count, size_t stride, uint32_t bit_width, uint32_t* words)
+	{
+		uint64_t buffer = 0;
+		uint32_t filled = 0;
+		for (size_t index = 0; index < count; ++index)
+		{
+			buffer |= static_cast<uint64_t>(values[index * stride]) << filled;
+			filled += bit_width;
+			if (filled >= 32)
+			{
+				*words = static_cast<uint32_t>(buffer);
+				words += stride;
+				buffer >>= 32;
+				filled -= 32;
+			}
+		}
+		if (filled > 0)
+		{
+			*words = static_cast<uint32_t>(buffer);
+		}
+	}
+
+	void UnpackStrided(const uint32_t* words, size_t count, size_t stride, uint32_t bit_width, uint32_t* values)
+	{
+		const uint64_t mask = GetMask(bit_width);
+		uint64_t buffer = 0;
+		uint32_t filled = 0;
+		for (size_t index = 0; index < count; ++index)
+		{
+			if (filled < bit_width)
+			{
+				buffer |= static_cast<uint64_t>(*words) << filled;
+				words += stride;
+				filled += 32;
+			}
+			values[index * stride] = static_cast<uint32_t>(buffer & mask);
+			buffer >>= bit_width;
+			filled -= bit_width;
+		}
+	}
+
+#ifdef BIT_PACKING_SSE2
+	void UnpackBlock(const uint32_t* words, uint32_t bit_width, uint32_t* values)
+	{
+		const __m128i* input = reinterpret_cast<const __m128i*>(words);
+		__m128i* output = reinterpret_cast<__m128i*>(values);
+		const __m128i mask = _mm_set1_epi32(static_cast<int>(GetMask(bit_width)));
+		__m128i word = _mm_loadu_si128(input++);
+		uint32_t shift = 0;
+		for (size_t index = 0; index < LANE_SIZE; ++index)
+		{
+			__m128i value = _mm_srl_epi32(word, _mm_cvtsi32_si128(static_cast<int>(shift)));
+			shift += bit_width;
+			// The last value of a lane ends exactly at a word boundary, no word follows it
+			if (shift >= 32 && index + 1 < LANE_SIZE)
+			{
+				word = _mm_loadu_si128(input++);
+				shift -= 32;
+				if (shift > 0)
+				{
+					value = _mm_or_si128(value, _mm_sll_epi32(word, _mm_cvtsi32_si128(static_cast<int>(bit_width - shift))));
+				}
+			}
+			_mm_storeu_si128(output + index, _mm_and_si128(value, mask));
+		}
+	}
+#else
+	void UnpackBlock(const uint32_t* words, uint32_t bit_width, uint32_t* values)
+	{
+		for (size_t lane = 0; lane < LANE_COUNT; ++lane)
+		{
+			UnpackStrided(words + lane, LANE_SIZE, LANE_COUNT, bit_width, values + lane);
+		}
+	}
+#endif
+}
+
+uint32_t GetBitWidth(const uint32_t* values, size_t count)
+{
+	uint32_t bits = 0;
+	for (size_t index = 0; index < count; ++index)
+	{
+		bits |= values[index];
+	}
+	uint32_t bit_width = 0;
+	for (; bits != 0; bits >>= 1)
+	{
+		++bit_width;
+	}
+	return bit_width;
+}
+
+size_t GetPackedWordCount(size_t count, uint32_t bit_width)
+{
+	return (count * bit_width + 31) / 32;
+}
+
+void PackBits(const uint32_t* values, size_t count, uint32_t bit_width, vector<uint32_t>& words)
+{
+	const size_t words_begin = words.size();
+	words.resize(words_begin + GetPackedWordCount(count, bit_width), 0);
+	if (bit_width == 0)
+	{
+		return;
+	}
+	if (count == BIT_PACKING_BLOCK_SIZE)
+	{
+		for (size_t lane = 0; lane < LANE_COUNT; ++lane)
+		{
+			PackStrided(values + lane, LANE_SIZE, LANE_COUNT, bit_width, words.data() + words_begin + lane);
+		}
+	}
+	else
+	{
+		PackStrided(values, count, 1, bit_width, words.data() + words_begin);
+	}
+}
+
+const uint32_t* UnpackBits(const uint32_t* words, size_t count, uint32_t bit_width, uint32_t* values)
+{
+	if (bit_width == 0)
+	{
+		fill(values, values + count, 0u);
+	}
+	else if (count == BIT_PACKING_BLOCK_SIZE)
+	{
+		UnpackBlock(words, bit_width, values);
+	}
+	else
+	{
+		UnpackStrided(words, count, 1, bit_width, values);
+	}
+	return words + GetPackedWordCount(count, bit_width);
+}
+
+void DecodeGaps(uint32_t* values, size_t count, uint32_t previous)
+{
+	size_t index = 0;
+#ifdef BIT_PACKING_SSE2
+	// Prefix sums of four values in two shifted additions, carried over in the last lane
+	const __m128i ones = _mm_set1_epi32(1);
+	__m128i carry = _mm_set1_epi32(static_cast<int>(previous));
+	for (; index + 4 <= count; index += 4)
+	{
+		__m128i* position = reinterpret_cast<__m128i*>(values + index);
+		__m128i sums = _mm_add_epi32(_mm_loadu_si128(position), ones);
+		sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 4));
+		sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 8));
+		sums = _mm_add_epi32(sums, carry);
+		_mm_storeu_si128(position, sums);
+		carry = _mm_shuffle_epi32(sums, 0xFF);
+	}
+	if (index > 0)
+	{
+		previous = values[index - 1];
+	}
+#endif
+	for (; index < count; ++index)
+	{
+		previous += values[index] + 1;
+		values[index] = previous;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Full blocks of this many values are packed in four interleaved lanes (BP128 layout): value i
+// goes to lane i % 4, so that SSE2 unpacks four values per instruction. Shorter blocks are packed
+// sequentially, they are the tails of posting lists and would waste most of a padded block.
+const size_t BIT_PACKING_BLOCK_SIZE = 128;
+
+// Smallest bit width that holds all values, 0 if they are all zero
+uint32_t GetBitWidth(const uint32_t* values, size_t count);
+
+// Number of 32-bit words PackBits appends for count values of the given width
+size_t GetPackedWordCount(size_t count, uint32_t bit_width);
+
+// count is at most BIT_PACKING_BLOCK_SIZE and all values fit in bit_width bits
+void PackBits(const uint32_t* values, size_t count, uint32_t bit_width, std::vector<uint32_t>& words);
+
+// Reverses PackBits, returns the word after the packed ones
+const uint32_t* UnpackBits(const uint32_t* words, size_t count, uint32_t bit_width, uint32_t* values);
+
+// Turns the gaps minus one between consecutive increasing numbers back into the numbers,
+// the first gap is taken from previous
+void DecodeGaps(uint32_t* values, size_t count, uint32_t previous);
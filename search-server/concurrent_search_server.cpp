@@ -0,0 +1,294 @@
+#include "concurrent_search_server.h"
+
+#include <algorithm>
+#include <execution>
+#include <functional>
+#include <numeric>
+#include <thread>
+
+using namespace std;
+
+ConcurrentSearchServer::ConcurrentSearchServer(const string& stop_words)
+	: ConcurrentSearchServer(string_view{ stop_words })
+{
+}
+
+ConcurrentSearchServer::ConcurrentSearchServer(string_view stop_words)
+{
+	for (unique_ptr<IndexShard>& shard : shards_)
+	{
+		shard = make_unique<IndexShard>(stop_words);
+	}
+}
+
+ConcurrentSearchServer::ShardReader::~ShardReader()
+{
+	if (count_)
+	{
+		count_->fetch_sub(1);
+	}
+}
+
+const SearchServer& ConcurrentSearchServer::ShardReader::Enter(const IndexShard& shard)
+{
+	count_ = &shard.read_indicators[shard.version.load()][GetReaderSlot()].count;
+	count_->fetch_add(1);
+	return shard.servers[shard.published.load()];
+}
+
+size_t ConcurrentSearchServer::GetReaderSlot()
+{
+	thread_local const size_t slot = hash<thread::id>()(this_thread::get_id()) % READER_COUNTER_COUNT;
+	return slot;
+}
+
+ConcurrentSearchServer::IndexShard& ConcurrentSearchServer::GetShard(int document_id)
+{
+	return *shards_[static_cast<uint32_t>(document_id) % INDEX_SHARD_COUNT];
+}
+
+void ConcurrentSearchServer::WaitForReaders(const IndexShard& shard, int version)
+{
+	for (const ReaderCounter& counter : shard.read_indicators[version])
+	{
+		while (counter.count.load() != 0)
+		{
+			this_thread::yield();
+		}
+	}
+}
+
+void ConcurrentSearchServer::SwitchVersion(IndexShard& shard)
+{
+	// Readers that entered under the previous version may still hold the old copy,
+	// the ones arriving after the switch already see the new one
+	const int previous = shard.version.load();
+	const int next = 1 - previous;
+	WaitForReaders(shard, next);
+	shard.version.store(next);
+	WaitForReaders(shard, previous);
+}
+
+int ConcurrentSearchServer::GetDocumentCount() const
+{
+	int document_count = 0;
+	for (const unique_ptr<IndexShard>& shard : shards_)
+	{
+		document_count += Read(*shard, [](const SearchServer& server) { return server.GetDocumentCount(); });
+	}
+	return document_count;
+}
+
+vector<Document> ConcurrentSearchServer::FindTopDocuments(string_view query) const
+{
+	return FindTopDocuments(query, DocumentStatus::ACTUAL);
+}
+
+vector<Document> ConcurrentSearchServer::FindTopDocuments(string_view query, DocumentStatus status) const
+{
+	return FindTopDocumentsInShards(query,
+		[query, status](const SearchServer& server, const SearchServer::QueryStatistics& statistics)
+		{
+			return server.FindTopDocuments(query, status, statistics);
+		});
+}
+
+void ConcurrentSearchServer::Ingest(IngestRequest& request)
+{
+	IndexShard& shard = GetShard(request.document.id);
+	{
+		lock_guard guard(shard.queue_mutex);
+		shard.requests.push_back(&request);
+	}
+
+	// Only one caller of the shard combines at a time, the others wait for their own request
+	// instead of queueing on the combiner lock. A round ending without applying the request
+	// wakes them up to try to become the next combiner
+	while (true)
+	{
+		const uint64_t combine_round = shard.combine_round.load();
+		if (shard.combine_mutex.try_lock())
+		{
+			vector<IngestRequest*> requests;
+			{
+				lock_guard combine_guard(shard.combine_mutex, adopt_lock);
+				{
+					lock_guard guard(shard.queue_mutex);
+					requests.swap(shard.requests);
+				}
+				ApplyIngestRequests(shard, requests);
+			}
+			shard.combine_round.fetch_add(1);
+			CompleteIngestRequests(shard, requests);
+		}
+
+		unique_lock guard(shard.queue_mutex);
+		shard.applied.wait(guard, [&] { return request.is_done || shard.combine_round.load() != combine_round; });
+		if (request.is_done)
+		{
+			break;
+		}
+	}
+	if (request.error)
+	{
+		rethrow_exception(request.error);
+	}
+}
+
+void ConcurrentSearchServer::ApplyIngestRequests(IndexShard& shard, const vector<IngestRequest*>& requests)
+{
+	for (auto run_begin = requests.begin(); run_begin != requests.end();)
+	{
+		const bool is_removal = (*run_begin)->is_removal;
+		const auto run_end = find_if(run_begin, requests.end(),
+			[is_removal](const IngestRequest* request) { return request->is_removal != is_removal; });
+		try
+		{
+			const vector<IngestRequest*> run(run_begin, run_end);
+			if (is_removal)
+			{
+				vector<int> document_ids;
+				document_ids.reserve(run.size());
+				for (const IngestRequest* request : run)
+				{
+					document_ids.push_back(request->document.id);
+				}
+				Write(shard, [&document_ids](SearchServer& server) { server.RemoveDocuments(document_ids); });
+			}
+			else
+			{
+				ApplyAdditions(shard, run);
+			}
+		}
+		catch (...)
+		{
+			// Their callers wait until they are done, so none of the requests may be left behind
+			for (auto it = run_begin; it != requests.end(); ++it)
+			{
+				(*it)->error = current_exception();
+			}
+			return;
+		}
+		run_begin = run_end;
+	}
+}
+
+void ConcurrentSearchServer::CompleteIngestRequests(IndexShard& shard, const vector<IngestRequest*>& requests)
+{
+	// A request may be destroyed by its caller as soon as it is marked done,
+	// so it is not touched after that
+	{
+		lock_guard guard(shard.queue_mutex);
+		for (IngestRequest* request : requests)
+		{
+			request->is_done = true;
+		}
+	}
+	shard.applied.notify_all();
+}
+
+void ConcurrentSearchServer::ApplyAdditions(IndexShard& shard, const vector<IngestRequest*>& requests)
+{
+	vector<RawDocument> documents;
+	documents.reserve(requests.size());
+	for (const IngestRequest* request : requests)
+	{
+		documents.push_back(request->document);
+	}
+
+	try
+	{
+		if (documents.size() == 1)
+		{
+			const RawDocument& document = documents.front();
+			Write(shard, [&document](SearchServer& server) { server.AddDocument(document.id, document.text, document.status, document.ratings); });
+		}
+		else if (documents.size() < PARALLEL_INGEST_BATCH_SIZE)
+		{
+			Write(shard, [&documents](SearchServer& server) { server.AddDocuments(execution::seq, documents); });
+		}
+		else
+		{
+			Write(shard, [&documents](SearchServer& server) { server.AddDocuments(execution::par, documents); });
+		}
+	}
+	catch (...)
+	{
+		if (documents.size() == 1)
+		{
+			requests.front()->error = current_exception();
+			return;
+		}
+		// The batch changed nothing, so every document is retried alone to find the invalid ones
+		for (IngestRequest* request : requests)
+		{
+			try
+			{
+				const RawDocument& document = request->document;
+				Write(shard, [&document](SearchServer& server) { server.AddDocument(document.id, document.text, document.status, document.ratings); });
+			}
+			catch (...)
+			{
+				request->error = current_exception();
+			}
+		}
+	}
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings)
+{
+	IngestRequest request;
+	request.document = { document_id, document, status, ratings };
+	Ingest(request);
+}
+
+void ConcurrentSearchServer::AddDocuments(const vector<RawDocument>& documents)
+{
+	array<vector<RawDocument>, INDEX_SHARD_COUNT> shard_documents;
+	for (const RawDocument& document : documents)
+	{
+		shard_documents[static_cast<uint32_t>(document.id) % INDEX_SHARD_COUNT].push_back(document);
+	}
+	array<exception_ptr, INDEX_SHARD_COUNT> errors;
+	array<size_t, INDEX_SHARD_COUNT> shard_indexes;
+	iota(shard_indexes.begin(), shard_indexes.end(), 0);
+	for_each(execution::par, shard_indexes.begin(), shard_indexes.end(),
+		[this, &shard_documents, &errors](size_t shard_index)
+		{
+			if (shard_documents[shard_index].empty())
+			{
+				return;
+			}
+			try
+			{
+				Write(*shards_[shard_index], [&documents = shard_documents[shard_index]](SearchServer& server) { server.AddDocuments(documents); });
+			}
+			catch (...)
+			{
+				errors[shard_index] = current_exception();
+			}
+		});
+	for (const exception_ptr& error : errors)
+	{
+		if (error)
+		{
+			rethrow_exception(error);
+		}
+	}
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id)
+{
+	IngestRequest request;
+	request.document.id = document_id;
+	request.is_removal = true;
+	Ingest(request);
+}
+
+void ConcurrentSearchServer::Compact()
+{
+	for (const unique_ptr<IndexShard>& shard : shards_)
+	{
+		Write(*shard, [](SearchServer& server) { server.Compact(); });
+	}
+}
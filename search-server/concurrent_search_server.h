@@ -0,0 +1,230 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// SearchServer that can be queried while documents are added or removed.
+// Documents are split by id over independent index shards. Every shard keeps two identical copies
+// (left-right replication): readers always run on the published copy and never wait, the writer
+// changes the hidden copy, publishes it, waits for the readers still on the old copy to leave and
+// then repeats the change on it.
+// AddDocument and RemoveDocument may be called from many threads at once: requests are queued
+// in the shard of their document and applied in batches by whichever caller becomes the combiner
+// of that shard, the other callers wait for their own request. Callers only contend with the
+// callers of the same shard, and the shards apply their batches in parallel.
+// Searches add up the document counts of all shards first, so they rank as one SearchServer would
+class ConcurrentSearchServer
+{
+private:
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+	static constexpr size_t READER_COUNTER_COUNT = 16;
+	static constexpr size_t INDEX_SHARD_COUNT = 8;
+	// Smaller batches of additions are applied sequentially, the parallel path does not pay off.
+	// A batch holds at most one request per producer thread
+	static constexpr size_t PARALLEL_INGEST_BATCH_SIZE = 8;
+
+	struct alignas(CACHE_LINE_SIZE) ReaderCounter
+	{
+		std::atomic<int64_t> count{ 0 };
+	};
+
+	// Readers that entered under one version, spread over cache lines by thread
+	using ReadIndicator = std::array<ReaderCounter, READER_COUNTER_COUNT>;
+
+	// Lives on the stack of the calling thread until the combiner has applied it
+	struct IngestRequest
+	{
+		RawDocument document;
+		bool is_removal = false;
+		bool is_done = false;
+		std::exception_ptr error;
+	};
+
+	// Documents whose ids fall to the shard, with the requests queued for them
+	struct IndexShard
+	{
+		template <typename StringCollection>
+		explicit IndexShard(const StringCollection& stop_words);
+
+		std::array<SearchServer, 2> servers;
+		// Index of the copy readers use
+		std::atomic<int> published{ 0 };
+		std::atomic<int> version{ 0 };
+		mutable std::array<ReadIndicator, 2> read_indicators;
+		std::mutex write_mutex;
+		alignas(CACHE_LINE_SIZE) std::mutex queue_mutex;
+		// Requests of one document id are kept in the order they came
+		std::vector<IngestRequest*> requests;
+		// Signalled when queued requests are done or a combiner round ends
+		std::condition_variable applied;
+		std::mutex combine_mutex;
+		// Number of finished combiner rounds
+		std::atomic<uint64_t> combine_round{ 0 };
+	};
+
+	// Keeps the copy of a shard published when entering readable until destruction
+	class ShardReader
+	{
+	public:
+		ShardReader() = default;
+		ShardReader(const ShardReader&) = delete;
+		ShardReader& operator=(const ShardReader&) = delete;
+
+		~ShardReader();
+
+		const SearchServer& Enter(const IndexShard& shard);
+
+	private:
+		std::atomic<int64_t>* count_ = nullptr;
+	};
+
+	std::array<std::unique_ptr<IndexShard>, INDEX_SHARD_COUNT> shards_;
+
+	static size_t GetReaderSlot();
+
+	IndexShard& GetShard(int document_id);
+
+	template <typename Reader>
+	static auto Read(const IndexShard& shard, Reader reader);
+
+	// Applies writer to both copies of the shard, writers of a shard are serialized. It must make
+	// the same changes on every call, and if it throws the change is not published
+	template <typename Writer>
+	static void Write(IndexShard& shard, Writer writer);
+
+	static void WaitForReaders(const IndexShard& shard, int version);
+
+	// Moves new readers to the other read indicator and waits until nobody can see the hidden copy
+	static void SwitchVersion(IndexShard& shard);
+
+	// Queues the request and returns once it is applied, rethrowing its error
+	void Ingest(IngestRequest& request);
+
+	// Applies the requests in order, consecutive additions as one batch. Errors are stored in the
+	// requests, and if a batch fails as a whole, the requests from it on are not applied and get its error
+	static void ApplyIngestRequests(IndexShard& shard, const std::vector<IngestRequest*>& requests);
+
+	// Marks the requests done and wakes up the callers waiting on the shard
+	static void CompleteIngestRequests(IndexShard& shard, const std::vector<IngestRequest*>& requests);
+
+	static void ApplyAdditions(IndexShard& shard, const std::vector<IngestRequest*>& requests);
+
+	// Runs search on every shard with the statistics of the query over all of them and merges the results
+	template <typename ShardSearch>
+	std::vector<Document> FindTopDocumentsInShards(std::string_view query, ShardSearch search) const;
+
+public:
+	template <typename StringCollection>
+	explicit ConcurrentSearchServer(const StringCollection& stop_words);
+
+	explicit ConcurrentSearchServer(const std::string& stop_words);
+
+	explicit ConcurrentSearchServer(std::string_view stop_words);
+
+	int GetDocumentCount() const;
+
+	std::vector<Document> FindTopDocuments(std::string_view query) const;
+
+	std::vector<Document> FindTopDocuments(std::string_view query, DocumentStatus status) const;
+
+	template <typename DocumentsFilter>
+	std::vector<Document> FindTopDocuments(std::string_view query, DocumentsFilter documents_filter) const;
+
+	// Thread-safe, the document is searchable when the call returns
+	void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+	// Every shard adds its part of the documents as one batch, all shards at once. If a part
+	// is invalid, it is not added and the first such error is rethrown, other parts may be added
+	void AddDocuments(const std::vector<RawDocument>& documents);
+
+	// Thread-safe, the document is gone from search results when the call returns
+	void RemoveDocument(int document_id);
+
+	void Compact();
+};
+
+template <typename StringCollection>
+ConcurrentSearchServer::IndexShard::IndexShard(const StringCollection& stop_words)
+	: servers{ SearchServer(stop_words), SearchServer(stop_words) }
+{
+}
+
+template <typename StringCollection>
+ConcurrentSearchServer::ConcurrentSearchServer(const StringCollection& stop_words)
+{
+	for (std::unique_ptr<IndexShard>& shard : shards_)
+	{
+		shard = std::make_unique<IndexShard>(stop_words);
+	}
+}
+
+template <typename Reader>
+auto ConcurrentSearchServer::Read(const IndexShard& shard, Reader reader)
+{
+	ShardReader shard_reader;
+	return reader(shard_reader.Enter(shard));
+}
+
+template <typename Writer>
+void ConcurrentSearchServer::Write(IndexShard& shard, Writer writer)
+{
+	std::lock_guard guard(shard.write_mutex);
+	const int published = shard.published.load();
+	writer(shard.servers[1 - published]);
+	shard.published.store(1 - published);
+	SwitchVersion(shard);
+	writer(shard.servers[published]);
+}
+
+template <typename ShardSearch>
+std::vector<Document> ConcurrentSearchServer::FindTopDocumentsInShards(std::string_view query, ShardSearch search) const
+{
+	// All shards are held for the whole search, so that the statistics match the copies searched
+	std::array<ShardReader, INDEX_SHARD_COUNT> shard_readers;
+	std::array<const SearchServer*, INDEX_SHARD_COUNT> servers;
+	for (size_t shard_index = 0; shard_index < INDEX_SHARD_COUNT; ++shard_index)
+	{
+		servers[shard_index] = &shard_readers[shard_index].Enter(*shards_[shard_index]);
+	}
+	SearchServer::QueryStatistics statistics = servers.front()->GetQueryStatistics(query);
+	for (size_t shard_index = 1; shard_index < INDEX_SHARD_COUNT; ++shard_index)
+	{
+		const SearchServer::QueryStatistics shard_statistics = servers[shard_index]->GetQueryStatistics(query);
+		statistics.document_count += shard_statistics.document_count;
+		for (size_t word_index = 0; word_index < statistics.document_freqs.size(); ++word_index)
+		{
+			statistics.document_freqs[word_index] += shard_statistics.document_freqs[word_index];
+		}
+	}
+
+	std::vector<Document> documents;
+	for (const SearchServer* server : servers)
+	{
+		const std::vector<Document> shard_documents = search(*server, statistics);
+		documents.insert(documents.end(), shard_documents.begin(), shard_documents.end());
+	}
+	const size_t top_count = std::min(documents.size(), servers.front()->GetMaxResultDocumentCount());
+	std::partial_sort(documents.begin(), documents.begin() + top_count, documents.end(), SearchServer::IsMoreRelevant);
+	documents.resize(top_count);
+	return documents;
+}
+
+template <typename DocumentsFilter>
+std::vector<Document> ConcurrentSearchServer::FindTopDocuments(std::string_view query, DocumentsFilter documents_filter) const
+{
+	return FindTopDocumentsInShards(query,
+		[query, &documents_filter](const SearchServer& server, const SearchServer::QueryStatistics& statistics)
+		{
+			return server.FindTopDocuments(query, documents_filter, statistics);
+		});
+}
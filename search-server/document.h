@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <string_view>
+#include <vector>
 
 struct Document
 {
@@ -19,4 +21,13 @@ enum class DocumentStatus
 	IRRELEVANT,
 	BANNED,
 	REMOVED
+};
+
+// Input of SearchServer::AddDocuments, the text has to outlive the call only
+struct RawDocument
+{
+	int id = 0;
+	std::string_view text;
+	DocumentStatus status = DocumentStatus::ACTUAL;
+	std::vector<int> ratings;
 };
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "document_bitmap.h"
+
+#include <bitset>
+#include <iterator>
+
+using namespace std;
+
+void DocumentBitmap::Add(DocumentOrdinal ordinal)
+{
+	AddValue(GetContainer(static_cast<uint16_t>(ordinal >> 16)), static_cast<uint16_t>(ordinal));
+}
+
+void DocumentBitmap::Remove(DocumentOrdinal ordinal)
+{
+	const Container* found = FindContainer(static_cast<uint16_t>(ordinal >> 16));
+	if (found == nullptr)
+	{
+		return;
+	}
+	Container& container = containers_[found - containers_.data()];
+	const uint16_t value = static_cast<uint16_t>(ordinal);
+	if (!container.bitset.empty())
+	{
+		uint64_t& word = container.bitset[value >> 6];
+		const uint64_t bit = uint64_t{ 1 } << (value & 63);
+		if (word & bit)
+		{
+			word &= ~bit;
+			--container.count;
+			ToArray(container);
+		}
+	}
+	else
+	{
+		const auto it = lower_bound(container.values.begin(), container.values.end(), value);
+		if (it != container.values.end() && *it == value)
+		{
+			container.values.erase(it);
+			--container.count;
+		}
+	}
+	if (container.count == 0)
+	{
+		containers_.erase(containers_.begin() + (found - containers_.data()));
+	}
+}
+
+size_t DocumentBitmap::GetCount() const
+{
+	size_t count = 0;
+	for (const Container& container : containers_)
+	{
+		count += container.count;
+	}
+	return count;
+}
+
+bool DocumentBitmap::IsEmpty() const
+{
+	return containers_.empty();
+}
+
+DocumentBitmap& DocumentBitmap::operator|=(const DocumentBitmap& other)
+{
+	vector<Container> containers;
+	containers.reserve(containers_.size() + other.containers_.size());
+	auto it = containers_.begin();
+	auto other_it = other.containers_.begin();
+	while (it != containers_.end() || other_it != other.containers_.end())
+	{
+		if (other_it == other.containers_.end() || (it != containers_.end() && it->key < other_it->key))
+		{
+			containers.push_back(move(*it++));
+		}
+		else if (it == containers_.end() || other_it->key < it->key)
+		{
+			containers.push_back(*other_it++);
+		}
+		else
+		{
+			Unite(*it, *other_it++);
+			containers.push_back(move(*it++));
+		}
+	}
+	containers_ = move(containers);
+	return *this;
+}
+
+DocumentBitmap& DocumentBitmap::operator-=(const DocumentBitmap& other)
+{
+	auto other_it = other.containers_.begin();
+	for (Container& container : containers_)
+	{
+		while (other_it != other.containers_.end() && other_it->key < container.key)
+		{
+			++other_it;
+		}
+		if (other_it != other.containers_.end() && other_it->key == container.key)
+		{
+			Subtract(container, *other_it);
+		}
+	}
+	containers_.erase(remove_if(containers_.begin(), containers_.end(),
+		[](const Container& container) { return container.count == 0; }), containers_.end());
+	return *this;
+}
+
+DocumentBitmap::Container& DocumentBitmap::GetContainer(uint16_t key)
+{
+	if (containers_.empty() || containers_.back().key < key)
+	{
+		containers_.push_back({ key, {}, {}, 0 });
+		return containers_.back();
+	}
+	const auto it = lower_bound(containers_.begin(), containers_.end(), key,
+		[](const Container& container, uint16_t key) { return container.key < key; });
+	if (it->key == key)
+	{
+		return *it;
+	}
+	return *containers_.insert(it, { key, {}, {}, 0 });
+}
+
+void DocumentBitmap::AddValue(Container& container, uint16_t value)
+{
+	if (!container.bitset.empty())
+	{
+		uint64_t& word = container.bitset[value >> 6];
+		const uint64_t bit = uint64_t{ 1 } << (value & 63);
+		container.count += (word & bit) == 0;
+		word |= bit;
+		return;
+	}
+	if (container.values.empty() || container.values.back() < value)
+	{
+		container.values.push_back(value);
+	}
+	else
+	{
+		const auto it = lower_bound(container.values.begin(), container.values.end(), value);
+		if (*it == value)
+		{
+			return;
+		}
+		container.values.insert(it, value);
+	}
+	++container.count;
+	if (container.count > ARRAY_MAX_SIZE)
+	{
+		ToBitset(container);
+	}
+}
+
+void DocumentBitmap::ToBitset(Container& container)
+{
+	container.bitset.assign(BITSET_WORD_COUNT, 0);
+	for (const uint16_t value : container.values)
+	{
+		container.bitset[value >> 6] |= uint64_t{ 1 } << (value & 63);
+	}
+	vector<uint16_t>().swap(container.values);
+}
+
+void DocumentBitmap::ToArray(Container& container)
+{
+	if (container.bitset.empty() || container.count >= ARRAY_MIN_SIZE)
+	{
+		return;
+	}
+	container.values.reserve(container.count);
+	for (size_t word_index = 0; word_index < BITSET_WORD_COUNT; ++word_index)
+	{
+		for (size_t bit = 0; bit < 64; ++bit)
+		{
+			if ((container.bitset[word_index] >> bit) & 1)
+			{
+				container.values.push_back(static_cast<uint16_t>(word_index * 64 + bit));
+			}
+		}
+	}
+	vector<uint64_t>().swap(container.bitset);
+}
+
+void DocumentBitmap::Unite(Container& container, const Container& other)
+{
+	if (container.bitset.empty() && other.bitset.empty() && container.count + other.count <= ARRAY_MAX_SIZE)
+	{
+		vector<uint16_t> values;
+		values.reserve(container.count + other.count);
+		set_union(container.values.begin(), container.values.end(), other.values.begin(), other.values.end(), back_inserter(values));
+		container.values = move(values);
+		container.count = static_cast<uint32_t>(container.values.size());
+		return;
+	}
+	if (container.bitset.empty())
+	{
+		ToBitset(container);
+	}
+	if (!other.bitset.empty())
+	{
+		for (size_t word_index = 0; word_index < BITSET_WORD_COUNT; ++word_index)
+		{
+			container.bitset[word_index] |= other.bitset[word_index];
+		}
+	}
+	else
+	{
+		for (const uint16_t value : other.values)
+		{
+			container.bitset[value >> 6] |= uint64_t{ 1 } << (value & 63);
+		}
+	}
+	container.count = CountBits(container.bitset);
+	ToArray(container);
+}
+
+void DocumentBitmap::Subtract(Container& container, const Container& other)
+{
+	if (container.bitset.empty())
+	{
+		auto is_in_other = [&other](uint16_t value)
+		{
+			if (!other.bitset.empty())
+			{
+				return ((other.bitset[value >> 6] >> (value & 63)) & 1) != 0;
+			}
+			return binary_search(other.values.begin(), other.values.end(), value);
+		};
+		container.values.erase(remove_if(container.values.begin(), container.values.end(), is_in_other), container.values.end());
+		container.count = static_cast<uint32_t>(container.values.size());
+		return;
+	}
+	if (!other.bitset.empty())
+	{
+		for (size_t word_index = 0; word_index < BITSET_WORD_COUNT; ++word_index)
+		{
+			container.bitset[word_index] &= ~other.bitset[word_index];
+		}
+	}
+	else
+	{
+		for (const uint16_t value : other.values)
+		{
+			container.bitset[value >> 6] &= ~(uint64_t{ 1 } << (value & 63));
+		}
+	}
+	container.count = CountBits(container.bitset);
+	ToArray(container);
+}
+
+uint32_t DocumentBitmap::CountBits(const vector<uint64_t>& bitset)
+{
+	uint32_t count = 0;
+	for (const uint64_t word : bitset)
+	{
+		count += static_cast<uint32_t>(std::bitset<64>(word).count());
+	}
+	return count;
+}
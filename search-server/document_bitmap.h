@@ -0,0 +1,91 @@
+#pragma once
+
+#include "index_segment.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Compressed set of document ordinals in the roaring layout: ordinals are grouped by their high
+// 16 bits, and every group keeps its low 16 bits either as a sorted array or, once it has more
+// than ARRAY_MAX_SIZE of them, as a 65536-bit bitset. A bitset turns back into an array only once
+// it drops below ARRAY_MIN_SIZE, so adding and removing around the limit does not convert every time.
+// Unions and differences of bitsets work a 64-bit word at a time
+class DocumentBitmap
+{
+public:
+	// Adding ordinals in increasing order appends to the last group without searching
+	void Add(DocumentOrdinal ordinal);
+
+	void Remove(DocumentOrdinal ordinal);
+
+	bool Contains(DocumentOrdinal ordinal) const;
+
+	size_t GetCount() const;
+
+	bool IsEmpty() const;
+
+	DocumentBitmap& operator|=(const DocumentBitmap& other);
+
+	// Removes the ordinals of other
+	DocumentBitmap& operator-=(const DocumentBitmap& other);
+
+private:
+	static const size_t ARRAY_MAX_SIZE = 4096;
+	static const size_t ARRAY_MIN_SIZE = ARRAY_MAX_SIZE / 2;
+	static const size_t BITSET_WORD_COUNT = (1 << 16) / 64;
+
+	struct Container
+	{
+		uint16_t key;
+		// Sorted low bits while bitset is empty
+		std::vector<uint16_t> values;
+		std::vector<uint64_t> bitset;
+		uint32_t count = 0;
+	};
+
+	std::vector<Container> containers_;
+
+	const Container* FindContainer(uint16_t key) const;
+
+	Container& GetContainer(uint16_t key);
+
+	static void AddValue(Container& container, uint16_t value);
+
+	static void ToBitset(Container& container);
+
+	// Turns a bitset with fewer than ARRAY_MIN_SIZE values left back into an array
+	static void ToArray(Container& container);
+
+	static void Unite(Container& container, const Container& other);
+
+	static void Subtract(Container& container, const Container& other);
+
+	static uint32_t CountBits(const std::vector<uint64_t>& bitset);
+};
+
+inline const DocumentBitmap::Container* DocumentBitmap::FindContainer(uint16_t key) const
+{
+	if (!containers_.empty() && containers_.back().key == key)
+	{
+		return &containers_.back();
+	}
+	const auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+		[](const Container& container, uint16_t key) { return container.key < key; });
+	return it != containers_.end() && it->key == key ? &*it : nullptr;
+}
+
+inline bool DocumentBitmap::Contains(DocumentOrdinal ordinal) const
+{
+	const Container* container = FindContainer(static_cast<uint16_t>(ordinal >> 16));
+	if (container == nullptr)
+	{
+		return false;
+	}
+	const uint16_t value = static_cast<uint16_t>(ordinal);
+	if (!container->bitset.empty())
+	{
+		return (container->bitset[value >> 6] >> (value & 63)) & 1;
+	}
+	return std::binary_search(container->values.begin(), container->values.end(), value);
+}
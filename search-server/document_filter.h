@@ -0,0 +1,169 @@
+#pragma once
+
+#include "document.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <type_traits>
+
+// Predicate of a DocumentFilter without a custom condition
+struct AnyDocument
+{
+	bool operator()(int, DocumentStatus, int) const
+	{
+		return true;
+	}
+};
+
+// Conjunction of conditions on document attributes that FindTopDocuments checks against its
+// document columns: a set of statuses, inclusive rating and id ranges, an id remainder and a
+// custom predicate. The built-in conditions are evaluated without branches, a filter of a single
+// status is answered by the status bitmap, and the predicate is called only for documents
+// passing the rest. Filters are built by chaining, for example
+// DocumentFilter().WithStatuses({ DocumentStatus::ACTUAL }).WithRatings(3, 5).Where(predicate)
+template <typename Predicate = AnyDocument>
+class DocumentFilter
+{
+public:
+	DocumentFilter() = default;
+
+	explicit DocumentFilter(Predicate predicate);
+
+	DocumentFilter& WithStatuses(std::initializer_list<DocumentStatus> statuses);
+
+	DocumentFilter& WithRatings(int min_rating, int max_rating);
+
+	DocumentFilter& WithIds(int min_id, int max_id);
+
+	// Documents whose id gives the remainder when divided by divisor, which must be positive
+	DocumentFilter& WithIdRemainder(int divisor, int remainder);
+
+	// Same conditions with the custom predicate replaced
+	template <typename CustomPredicate>
+	DocumentFilter<CustomPredicate> Where(CustomPredicate predicate) const;
+
+	// The only status the filter accepts, if there is exactly one
+	std::optional<DocumentStatus> GetSingleStatus() const;
+
+	bool operator()(int document_id, DocumentStatus status, int rating) const;
+
+private:
+	template <typename OtherPredicate>
+	friend class DocumentFilter;
+
+	// Bit i accepts the status with value i
+	uint32_t status_mask_ = ~0u;
+	// Ranges are kept as their minimum and length, so that a value is inside if value - min <= length in unsigned arithmetic
+	uint32_t min_rating_ = static_cast<uint32_t>(std::numeric_limits<int>::min());
+	uint32_t rating_span_ = std::numeric_limits<uint32_t>::max();
+	uint32_t min_id_ = static_cast<uint32_t>(std::numeric_limits<int>::min());
+	uint32_t id_span_ = std::numeric_limits<uint32_t>::max();
+	int id_divisor_ = 1;
+	int id_remainder_ = 0;
+	// Set by a range whose maximum is below its minimum
+	bool is_empty_ = false;
+	Predicate predicate_;
+};
+
+template <typename T>
+struct IsDocumentFilter : std::false_type
+{
+};
+
+template <typename Predicate>
+struct IsDocumentFilter<DocumentFilter<Predicate>> : std::true_type
+{
+};
+
+template <typename Predicate>
+DocumentFilter<Predicate>::DocumentFilter(Predicate predicate)
+	: predicate_(predicate)
+{
+}
+
+template <typename Predicate>
+DocumentFilter<Predicate>& DocumentFilter<Predicate>::WithStatuses(std::initializer_list<DocumentStatus> statuses)
+{
+	status_mask_ = 0;
+	for (const DocumentStatus status : statuses)
+	{
+		status_mask_ |= 1u << static_cast<uint32_t>(status);
+	}
+	return *this;
+}
+
+template <typename Predicate>
+DocumentFilter<Predicate>& DocumentFilter<Predicate>::WithRatings(int min_rating, int max_rating)
+{
+	min_rating_ = static_cast<uint32_t>(min_rating);
+	rating_span_ = static_cast<uint32_t>(max_rating) - min_rating_;
+	is_empty_ = is_empty_ || min_rating > max_rating;
+	return *this;
+}
+
+template <typename Predicate>
+DocumentFilter<Predicate>& DocumentFilter<Predicate>::WithIds(int min_id, int max_id)
+{
+	min_id_ = static_cast<uint32_t>(min_id);
+	id_span_ = static_cast<uint32_t>(max_id) - min_id_;
+	is_empty_ = is_empty_ || min_id > max_id;
+	return *this;
+}
+
+template <typename Predicate>
+DocumentFilter<Predicate>& DocumentFilter<Predicate>::WithIdRemainder(int divisor, int remainder)
+{
+	id_divisor_ = divisor;
+	id_remainder_ = remainder;
+	return *this;
+}
+
+template <typename Predicate>
+template <typename CustomPredicate>
+DocumentFilter<CustomPredicate> DocumentFilter<Predicate>::Where(CustomPredicate predicate) const
+{
+	DocumentFilter<CustomPredicate> filter(predicate);
+	filter.status_mask_ = status_mask_;
+	filter.min_rating_ = min_rating_;
+	filter.rating_span_ = rating_span_;
+	filter.min_id_ = min_id_;
+	filter.id_span_ = id_span_;
+	filter.id_divisor_ = id_divisor_;
+	filter.id_remainder_ = id_remainder_;
+	filter.is_empty_ = is_empty_;
+	return filter;
+}
+
+template <typename Predicate>
+std::optional<DocumentStatus> DocumentFilter<Predicate>::GetSingleStatus() const
+{
+	for (uint32_t status = 0; status < 32; ++status)
+	{
+		if (status_mask_ == 1u << status)
+		{
+			return static_cast<DocumentStatus>(status);
+		}
+	}
+	return std::nullopt;
+}
+
+template <typename Predicate>
+bool DocumentFilter<Predicate>::operator()(int document_id, DocumentStatus status, int rating) const
+{
+	// Conditions are combined with & rather than &&, so they compile to flag arithmetic instead of jumps
+	const bool is_matched = (((status_mask_ >> static_cast<uint32_t>(status)) & 1u) != 0)
+		& (static_cast<uint32_t>(rating) - min_rating_ <= rating_span_)
+		& (static_cast<uint32_t>(document_id) - min_id_ <= id_span_)
+		& (document_id % id_divisor_ == id_remainder_)
+		& !is_empty_;
+	if constexpr (std::is_same_v<Predicate, AnyDocument>)
+	{
+		return is_matched;
+	}
+	else
+	{
+		return is_matched && predicate_(document_id, status, rating);
+	}
+}
@@ -0,0 +1,64 @@
+#include "idf_table.h"
+
+#include <cmath>
+
+using namespace std;
+
+void IdfTable::SetTermCount(size_t term_count)
+{
+	document_freqs_.resize(term_count, 0);
+	log_document_freqs_.resize(term_count, log(0.));
+}
+
+void IdfTable::SetDocumentCount(size_t document_count)
+{
+	log_document_count_ = log(static_cast<double>(document_count));
+}
+
+void IdfTable::AddDocuments(TermId term_id, uint32_t document_count)
+{
+	document_freqs_[term_id] += document_count;
+	UpdateLog(term_id);
+}
+
+void IdfTable::RemoveDocument(TermId term_id)
+{
+	--document_freqs_[term_id];
+	UpdateLog(term_id);
+}
+
+void IdfTable::Remap(const vector<TermId>& term_remap, size_t term_count)
+{
+	vector<uint32_t> document_freqs(term_count, 0);
+	vector<double> log_document_freqs(term_count, log(0.));
+	for (TermId term_id = 0; term_id < term_remap.size(); ++term_id)
+	{
+		if (term_remap[term_id] != TermDictionary::NO_TERM)
+		{
+			document_freqs[term_remap[term_id]] = document_freqs_[term_id];
+			log_document_freqs[term_remap[term_id]] = log_document_freqs_[term_id];
+		}
+	}
+	document_freqs_ = move(document_freqs);
+	log_document_freqs_ = move(log_document_freqs);
+}
+
+size_t IdfTable::GetTermCount() const
+{
+	return document_freqs_.size();
+}
+
+uint32_t IdfTable::GetDocumentFreq(TermId term_id) const
+{
+	return document_freqs_[term_id];
+}
+
+double IdfTable::GetIDF(TermId term_id) const
+{
+	return log_document_count_ - log_document_freqs_[term_id];
+}
+
+void IdfTable::UpdateLog(TermId term_id)
+{
+	log_document_freqs_[term_id] = log(static_cast<double>(document_freqs_[term_id]));
+}
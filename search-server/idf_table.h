@@ -0,0 +1,38 @@
+#pragma once
+
+#include "term_dictionary.h"
+
+#include <cstdint>
+#include <vector>
+
+// Document frequency of every term next to its logarithm, so that on the query path
+// IDF = log(document count) - log(document frequency) is a table read and a subtraction.
+// Both logarithms are refreshed by the updates that change them.
+class IdfTable
+{
+public:
+	void SetTermCount(size_t term_count);
+
+	void SetDocumentCount(size_t document_count);
+
+	// Updates of different terms may run in parallel
+	void AddDocuments(TermId term_id, uint32_t document_count);
+
+	void RemoveDocument(TermId term_id);
+
+	// Keeps the terms term_remap maps somewhere else than TermDictionary::NO_TERM under their new ids
+	void Remap(const std::vector<TermId>& term_remap, size_t term_count);
+
+	size_t GetTermCount() const;
+
+	uint32_t GetDocumentFreq(TermId term_id) const;
+
+	double GetIDF(TermId term_id) const;
+
+private:
+	std::vector<uint32_t> document_freqs_;
+	std::vector<double> log_document_freqs_;
+	double log_document_count_ = 0.;
+
+	void UpdateLog(TermId term_id);
+};
@@ -0,0 +1,305 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+const Posting* LowerBoundPosting(PostingRange postings, DocumentOrdinal ordinal)
+{
+	return lower_bound(postings.begin(), postings.end(), ordinal,
+		[](const Posting& posting, DocumentOrdinal value) { return posting.ordinal < value; });
+}
+
+bool ContainsPosting(PostingRange postings, DocumentOrdinal ordinal)
+{
+	const Posting* it = LowerBoundPosting(postings, ordinal);
+	return it != postings.end() && it->ordinal == ordinal;
+}
+
+void PostingCursor::DecodeBlock(const PostingBlock* block)
+{
+	size_ = block->posting_count;
+	const uint32_t* data = UnpackBits(block_data_ + block->data_offset, size_, block->ordinal_bit_width, ordinals_);
+	UnpackBits(data, size_, block->count_bit_width, term_counts_);
+	// The first list of a segment may start at its first ordinal, which is 0 for the first segment
+	DecodeGaps(ordinals_, size_, block == blocks_begin_ ? first_ordinal_ - 1 : (block - 1)->last_ordinal);
+	for (size_t index = 0; index < size_; ++index)
+	{
+		++term_counts_[index];
+		term_freqs_[index] = static_cast<double>(term_counts_[index]) / document_sizes_[ordinals_[index] - first_ordinal_];
+	}
+}
+
+IndexSegment::IndexSegment(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal, vector<uint32_t> document_sizes)
+	: first_ordinal_(first_ordinal), last_ordinal_(last_ordinal), block_offsets_{ 0 }, document_sizes_(move(document_sizes))
+{
+}
+
+IndexSegment::IndexSegment(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal, const vector<TermId>& terms,
+	const vector<uint64_t>& offsets, const vector<Posting>& postings, vector<uint32_t> document_sizes)
+	: IndexSegment(first_ordinal, last_ordinal, move(document_sizes))
+{
+	for (size_t term_index = 0; term_index < terms.size(); ++term_index)
+	{
+		AppendList(terms[term_index], PostingRange(postings.data() + offsets[term_index], postings.data() + offsets[term_index + 1]));
+	}
+	Shrink();
+}
+
+IndexSegment::IndexSegment(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal, vector<TermId> terms,
+	vector<double> max_term_freqs, vector<uint64_t> block_offsets, vector<PostingBlock> blocks,
+	vector<uint32_t> block_data, vector<uint32_t> document_sizes)
+	: first_ordinal_(first_ordinal), last_ordinal_(last_ordinal), terms_(move(terms)), max_term_freqs_(move(max_term_freqs)),
+	block_offsets_(move(block_offsets)), blocks_(move(blocks)), block_data_(move(block_data)), document_sizes_(move(document_sizes))
+{
+	if (first_ordinal_ > last_ordinal_ || document_sizes_.size() != last_ordinal_ - first_ordinal_ ||
+		adjacent_find(terms_.begin(), terms_.end(), greater_equal<TermId>()) != terms_.end() ||
+		max_term_freqs_.size() != terms_.size() || block_offsets_.size() != terms_.size() + 1 ||
+		block_offsets_.front() != 0 || block_offsets_.back() != blocks_.size() ||
+		!is_sorted(block_offsets_.begin(), block_offsets_.end()))
+	{
+		throw invalid_argument("corrupted segment");
+	}
+
+	// Blocks follow each other in the data, and only the ordinals are decoded to check that every
+	// list stays increasing inside the segment, since cursors index document sizes with them
+	uint64_t data_size = 0;
+	uint32_t ordinals[POSTING_BLOCK_SIZE];
+	for (size_t term_index = 0; term_index < terms_.size(); ++term_index)
+	{
+		DocumentOrdinal lower_bound = first_ordinal_;
+		for (uint64_t block_index = block_offsets_[term_index]; block_index < block_offsets_[term_index + 1]; ++block_index)
+		{
+			const PostingBlock& block = blocks_[block_index];
+			if (block.posting_count == 0 || block.posting_count > POSTING_BLOCK_SIZE || block.data_offset != data_size ||
+				block.ordinal_bit_width > 32 || block.count_bit_width > 32)
+			{
+				throw invalid_argument("corrupted segment");
+			}
+			const size_t ordinal_words = GetPackedWordCount(block.posting_count, block.ordinal_bit_width);
+			data_size += ordinal_words + GetPackedWordCount(block.posting_count, block.count_bit_width);
+			if (data_size > block_data_.size())
+			{
+				throw invalid_argument("corrupted segment");
+			}
+			UnpackBits(block_data_.data() + block.data_offset, block.posting_count, block.ordinal_bit_width, ordinals);
+			DecodeGaps(ordinals, block.posting_count, lower_bound - 1);
+			for (size_t index = 0; index < block.posting_count; ++index)
+			{
+				if (ordinals[index] < lower_bound || ordinals[index] >= last_ordinal_)
+				{
+					throw invalid_argument("corrupted segment");
+				}
+				lower_bound = ordinals[index] + 1;
+			}
+			if (block.last_ordinal != ordinals[block.posting_count - 1])
+			{
+				throw invalid_argument("corrupted segment");
+			}
+			posting_count_ += block.posting_count;
+		}
+	}
+	if (data_size != block_data_.size())
+	{
+		throw invalid_argument("corrupted segment");
+	}
+}
+
+void IndexSegment::AppendList(TermId term_id, PostingRange postings)
+{
+	DocumentOrdinal previous = first_ordinal_ - 1;
+	double max_term_freq = 0.;
+	uint32_t gaps[POSTING_BLOCK_SIZE];
+	uint32_t counts[POSTING_BLOCK_SIZE];
+	const size_t posting_count = postings.end() - postings.begin();
+	for (size_t block_begin = 0; block_begin < posting_count; block_begin += POSTING_BLOCK_SIZE)
+	{
+		const size_t block_size = min(POSTING_BLOCK_SIZE, posting_count - block_begin);
+		PostingBlock block{ block_data_.size(), 0, static_cast<uint16_t>(block_size), 0, 0, 0. };
+		for (size_t index = 0; index < block_size; ++index)
+		{
+			const Posting& posting = postings.begin()[block_begin + index];
+			gaps[index] = posting.ordinal - previous - 1;
+			counts[index] = posting.term_count - 1;
+			previous = posting.ordinal;
+			block.max_term_freq = max(block.max_term_freq,
+				static_cast<double>(posting.term_count) / document_sizes_[posting.ordinal - first_ordinal_]);
+		}
+		block.last_ordinal = previous;
+		block.ordinal_bit_width = static_cast<uint8_t>(GetBitWidth(gaps, block_size));
+		block.count_bit_width = static_cast<uint8_t>(GetBitWidth(counts, block_size));
+		PackBits(gaps, block_size, block.ordinal_bit_width, block_data_);
+		PackBits(counts, block_size, block.count_bit_width, block_data_);
+		blocks_.push_back(block);
+		max_term_freq = max(max_term_freq, block.max_term_freq);
+	}
+	terms_.push_back(term_id);
+	max_term_freqs_.push_back(max_term_freq);
+	block_offsets_.push_back(blocks_.size());
+	posting_count_ += posting_count;
+}
+
+shared_ptr<const IndexSegment> IndexSegment::Build(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal,
+	vector<PostingList>& term_postings, const vector<TermId>& terms, const vector<char>& is_removed,
+	vector<uint32_t> document_sizes)
+{
+	IndexSegment segment(first_ordinal, last_ordinal, move(document_sizes));
+	vector<Posting> postings;
+	for (const TermId term_id : terms)
+	{
+		PostingList& term_list = term_postings[term_id];
+		TermPostings plain_list;
+		plain_list.postings = PostingRange(term_list.data(), term_list.data() + term_list.size());
+		plain_list.document_sizes = segment.document_sizes_.data();
+		plain_list.first_ordinal = first_ordinal;
+		postings.clear();
+		AppendLivePostings(plain_list, first_ordinal, is_removed, postings);
+		PostingList().swap(term_list);
+		if (!postings.empty())
+		{
+			segment.AppendList(term_id, PostingRange(postings.data(), postings.data() + postings.size()));
+		}
+	}
+	segment.Shrink();
+	return make_shared<const IndexSegment>(move(segment));
+}
+
+shared_ptr<const IndexSegment> IndexSegment::Merge(const vector<shared_ptr<const IndexSegment>>& segments,
+	const vector<char>& is_removed)
+{
+	vector<TermId> terms;
+	vector<uint32_t> document_sizes;
+	for (const auto& segment : segments)
+	{
+		vector<TermId> merged_terms;
+		set_union(terms.begin(), terms.end(), segment->terms_.begin(), segment->terms_.end(), back_inserter(merged_terms));
+		terms.swap(merged_terms);
+		document_sizes.insert(document_sizes.end(), segment->document_sizes_.begin(), segment->document_sizes_.end());
+	}
+
+	// Segments are ordered by ordinal, so concatenating the lists of a term keeps it sorted
+	const DocumentOrdinal first_ordinal = segments.front()->first_ordinal_;
+	IndexSegment merged(first_ordinal, segments.back()->last_ordinal_, move(document_sizes));
+	vector<size_t> term_indexes(segments.size(), 0);
+	vector<Posting> postings;
+	for (const TermId term_id : terms)
+	{
+		postings.clear();
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			const IndexSegment& segment = *segments[i];
+			if (term_indexes[i] < segment.terms_.size() && segment.terms_[term_indexes[i]] == term_id)
+			{
+				AppendLivePostings(segment.GetTermPostingsAt(term_indexes[i]++), first_ordinal, is_removed, postings);
+			}
+		}
+		if (!postings.empty())
+		{
+			merged.AppendList(term_id, PostingRange(postings.data(), postings.data() + postings.size()));
+		}
+	}
+	merged.Shrink();
+	return make_shared<const IndexSegment>(move(merged));
+}
+
+shared_ptr<const IndexSegment> IndexSegment::Compact(const vector<char>& is_removed, const vector<TermId>& term_remap) const
+{
+	IndexSegment compacted(first_ordinal_, last_ordinal_, document_sizes_);
+	vector<Posting> postings;
+	for (size_t term_index = 0; term_index < terms_.size(); ++term_index)
+	{
+		postings.clear();
+		AppendLivePostings(GetTermPostingsAt(term_index), first_ordinal_, is_removed, postings);
+		if (!postings.empty())
+		{
+			compacted.AppendList(term_remap[terms_[term_index]], PostingRange(postings.data(), postings.data() + postings.size()));
+		}
+	}
+	compacted.Shrink();
+	return make_shared<const IndexSegment>(move(compacted));
+}
+
+void IndexSegment::Shrink()
+{
+	terms_.shrink_to_fit();
+	max_term_freqs_.shrink_to_fit();
+	block_offsets_.shrink_to_fit();
+	blocks_.shrink_to_fit();
+	block_data_.shrink_to_fit();
+}
+
+DocumentOrdinal IndexSegment::GetFirstOrdinal() const
+{
+	return first_ordinal_;
+}
+
+DocumentOrdinal IndexSegment::GetLastOrdinal() const
+{
+	return last_ordinal_;
+}
+
+size_t IndexSegment::GetPostingCount() const
+{
+	return posting_count_;
+}
+
+const vector<TermId>& IndexSegment::GetTerms() const
+{
+	return terms_;
+}
+
+const vector<double>& IndexSegment::GetMaxTermFreqs() const
+{
+	return max_term_freqs_;
+}
+
+const vector<uint64_t>& IndexSegment::GetBlockOffsets() const
+{
+	return block_offsets_;
+}
+
+const vector<PostingBlock>& IndexSegment::GetBlocks() const
+{
+	return blocks_;
+}
+
+const vector<uint32_t>& IndexSegment::GetBlockData() const
+{
+	return block_data_;
+}
+
+TermPostings IndexSegment::GetTermPostings(TermId term_id) const
+{
+	const auto it = lower_bound(terms_.begin(), terms_.end(), term_id);
+	if (it == terms_.end() || *it != term_id)
+	{
+		return TermPostings();
+	}
+	return GetTermPostingsAt(it - terms_.begin());
+}
+
+TermPostings IndexSegment::GetTermPostingsAt(size_t term_index) const
+{
+	const PostingBlock* blocks = blocks_.data();
+	TermPostings term_postings;
+	term_postings.blocks = IteratorRange<const PostingBlock*>(blocks + block_offsets_[term_index], blocks + block_offsets_[term_index + 1]);
+	term_postings.block_data = block_data_.data();
+	term_postings.document_sizes = document_sizes_.data();
+	term_postings.first_ordinal = first_ordinal_;
+	term_postings.max_term_freq = max_term_freqs_[term_index];
+	return term_postings;
+}
+
+void IndexSegment::AppendLivePostings(const TermPostings& term_list, DocumentOrdinal first_ordinal,
+	const vector<char>& is_removed, vector<Posting>& postings)
+{
+	for (PostingCursor cursor(term_list); !cursor.IsAtEnd(); cursor.Next())
+	{
+		if (!is_removed[cursor.GetOrdinal() - first_ordinal])
+		{
+			postings.push_back({ cursor.GetOrdinal(), cursor.GetTermCount() });
+		}
+	}
+}
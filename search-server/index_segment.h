@@ -0,0 +1,274 @@
+#pragma once
+
+#include "bit_packing.h"
+#include "paginator.h"
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Dense internal number of a document, assigned in insertion order and never reused
+using DocumentOrdinal = uint32_t;
+
+// Term frequency is term_count divided by the number of words of the document
+struct Posting
+{
+	DocumentOrdinal ordinal;
+	uint32_t term_count;
+};
+
+// Postings of one term, kept sorted by ordinal
+using PostingList = std::vector<Posting>;
+
+using PostingRange = IteratorRange<const Posting*>;
+
+// Posting lists of segments are compressed in blocks of this many postings, which are also the unit of skipping
+const size_t POSTING_BLOCK_SIZE = BIT_PACKING_BLOCK_SIZE;
+
+// Header of a compressed block. Its data holds the gaps minus one between the ordinals, the first one
+// relative to the last ordinal of the previous block, then the term counts minus one, each bit-packed
+struct PostingBlock
+{
+	uint64_t data_offset;
+	DocumentOrdinal last_ordinal;
+	uint16_t posting_count;
+	uint8_t ordinal_bit_width;
+	uint8_t count_bit_width;
+	double max_term_freq;
+};
+
+// Posting list of a term with bounds of its term frequencies, for the whole list and per block.
+// Lists of the write segment are plain postings without blocks, segment lists are compressed blocks only.
+// document_sizes[i] is the number of words of the document with ordinal first_ordinal + i
+struct TermPostings
+{
+	PostingRange postings = PostingRange(nullptr, nullptr);
+	IteratorRange<const PostingBlock*> blocks = IteratorRange<const PostingBlock*>(nullptr, nullptr);
+	const uint32_t* block_data = nullptr;
+	const uint32_t* document_sizes = nullptr;
+	DocumentOrdinal first_ordinal = 0;
+	double max_term_freq = 0.;
+};
+
+// Walks a posting list in ordinal order one block at a time, decoding only the blocks it stops in
+class PostingCursor
+{
+public:
+	explicit PostingCursor(const TermPostings& term_postings);
+
+	bool IsAtEnd() const;
+
+	DocumentOrdinal GetOrdinal() const;
+
+	uint32_t GetTermCount() const;
+
+	double GetTermFreq() const;
+
+	void Next();
+
+	// Moves to the first posting with an ordinal not less than the given one
+	void Seek(DocumentOrdinal ordinal);
+
+	// Bound of the term frequency of the first posting with an ordinal not less than the given one,
+	// 0 if there is none. Does not move the cursor, ordinals must not decrease between calls
+	double GetMaxTermFreq(DocumentOrdinal ordinal);
+
+private:
+	// Postings of the current block, position_ == size_ at the end of the list
+	DocumentOrdinal ordinals_[POSTING_BLOCK_SIZE];
+	uint32_t term_counts_[POSTING_BLOCK_SIZE];
+	double term_freqs_[POSTING_BLOCK_SIZE];
+	size_t position_ = 0;
+	size_t size_ = 0;
+	// Plain postings and blocks that are not loaded yet
+	const Posting* next_posting_;
+	const Posting* postings_end_;
+	const PostingBlock* blocks_begin_;
+	const PostingBlock* next_block_;
+	const PostingBlock* blocks_end_;
+	const PostingBlock* bound_block_;
+	const uint32_t* block_data_;
+	const uint32_t* document_sizes_;
+	DocumentOrdinal first_ordinal_;
+	double max_term_freq_;
+
+	void LoadNext();
+
+	void DecodeBlock(const PostingBlock* block);
+};
+
+// First posting whose ordinal is not less than the given one
+const Posting* LowerBoundPosting(PostingRange postings, DocumentOrdinal ordinal);
+
+bool ContainsPosting(PostingRange postings, DocumentOrdinal ordinal);
+
+// Immutable, read-optimized part of the inverted index with the postings of documents
+// whose ordinals are in [GetFirstOrdinal(), GetLastOrdinal()).
+// All posting lists are stored back to back as compressed blocks, ordered by term id.
+// Factories take removal flags of the documents of the resulting segment, indexed by ordinal
+// minus its first ordinal, and drop the postings of removed documents
+class IndexSegment
+{
+public:
+	// terms are sorted, offsets has terms.size() + 1 elements and delimits the lists of the terms in postings.
+	// document_sizes holds the numbers of words of the documents of the segment
+	IndexSegment(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal, const std::vector<TermId>& terms,
+		const std::vector<uint64_t>& offsets, const std::vector<Posting>& postings, std::vector<uint32_t> document_sizes);
+
+	// Takes over compressed lists in the layout the getters below return, without recompressing them.
+	// Throws std::invalid_argument if the arrays are inconsistent or a list leaves the ordinals of the segment
+	IndexSegment(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal, std::vector<TermId> terms,
+		std::vector<double> max_term_freqs, std::vector<uint64_t> block_offsets, std::vector<PostingBlock> blocks,
+		std::vector<uint32_t> block_data, std::vector<uint32_t> document_sizes);
+
+	// Takes the lists of the given sorted terms out of term_postings, empty lists are skipped
+	static std::shared_ptr<const IndexSegment> Build(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal,
+		std::vector<PostingList>& term_postings, const std::vector<TermId>& terms, const std::vector<char>& is_removed,
+		std::vector<uint32_t> document_sizes);
+
+	// Segments must be adjacent and ordered by ordinal
+	static std::shared_ptr<const IndexSegment> Merge(const std::vector<std::shared_ptr<const IndexSegment>>& segments,
+		const std::vector<char>& is_removed);
+
+	// Renumbers terms through term_remap, which must keep their order and may map
+	// to TermDictionary::NO_TERM only the terms left without live postings
+	std::shared_ptr<const IndexSegment> Compact(const std::vector<char>& is_removed, const std::vector<TermId>& term_remap) const;
+
+	DocumentOrdinal GetFirstOrdinal() const;
+
+	DocumentOrdinal GetLastOrdinal() const;
+
+	size_t GetPostingCount() const;
+
+	const std::vector<TermId>& GetTerms() const;
+
+	const std::vector<double>& GetMaxTermFreqs() const;
+
+	// Blocks of the list of terms[i] are [block_offsets[i], block_offsets[i + 1])
+	const std::vector<uint64_t>& GetBlockOffsets() const;
+
+	const std::vector<PostingBlock>& GetBlocks() const;
+
+	const std::vector<uint32_t>& GetBlockData() const;
+
+	// Empty list if the term has no postings in the segment
+	TermPostings GetTermPostings(TermId term_id) const;
+
+private:
+	DocumentOrdinal first_ordinal_;
+	DocumentOrdinal last_ordinal_;
+	std::vector<TermId> terms_;
+	// Largest term frequency of every list, and the blocks of every list delimited by block_offsets
+	std::vector<double> max_term_freqs_;
+	std::vector<uint64_t> block_offsets_;
+	std::vector<PostingBlock> blocks_;
+	std::vector<uint32_t> block_data_;
+	std::vector<uint32_t> document_sizes_;
+	size_t posting_count_ = 0;
+
+	// Empty segment, lists are added with AppendList
+	IndexSegment(DocumentOrdinal first_ordinal, DocumentOrdinal last_ordinal, std::vector<uint32_t> document_sizes);
+
+	TermPostings GetTermPostingsAt(size_t term_index) const;
+
+	// Compresses the list of a term greater than all terms of the segment
+	void AppendList(TermId term_id, PostingRange postings);
+
+	void Shrink();
+
+	// Appends the postings of documents that are not removed, is_removed starts at first_ordinal
+	static void AppendLivePostings(const TermPostings& term_list, DocumentOrdinal first_ordinal,
+		const std::vector<char>& is_removed, std::vector<Posting>& postings);
+};
+
+inline PostingCursor::PostingCursor(const TermPostings& term_postings)
+	: next_posting_(term_postings.postings.begin()), postings_end_(term_postings.postings.end()),
+	blocks_begin_(term_postings.blocks.begin()), next_block_(term_postings.blocks.begin()), blocks_end_(term_postings.blocks.end()),
+	bound_block_(term_postings.blocks.begin()), block_data_(term_postings.block_data), document_sizes_(term_postings.document_sizes),
+	first_ordinal_(term_postings.first_ordinal), max_term_freq_(term_postings.max_term_freq)
+{
+	LoadNext();
+}
+
+inline bool PostingCursor::IsAtEnd() const
+{
+	return position_ == size_;
+}
+
+inline DocumentOrdinal PostingCursor::GetOrdinal() const
+{
+	return ordinals_[position_];
+}
+
+inline uint32_t PostingCursor::GetTermCount() const
+{
+	return term_counts_[position_];
+}
+
+inline double PostingCursor::GetTermFreq() const
+{
+	return term_freqs_[position_];
+}
+
+inline void PostingCursor::Next()
+{
+	if (++position_ == size_)
+	{
+		LoadNext();
+	}
+}
+
+inline void PostingCursor::LoadNext()
+{
+	position_ = 0;
+	size_ = 0;
+	if (next_block_ != blocks_end_)
+	{
+		DecodeBlock(next_block_++);
+		return;
+	}
+	for (; next_posting_ != postings_end_ && size_ < POSTING_BLOCK_SIZE; ++next_posting_, ++size_)
+	{
+		ordinals_[size_] = next_posting_->ordinal;
+		term_counts_[size_] = next_posting_->term_count;
+		term_freqs_[size_] = static_cast<double>(term_counts_[size_]) / document_sizes_[ordinals_[size_] - first_ordinal_];
+	}
+}
+
+inline void PostingCursor::Seek(DocumentOrdinal ordinal)
+{
+	if (IsAtEnd() || ordinals_[position_] >= ordinal)
+	{
+		return;
+	}
+	if (ordinals_[size_ - 1] < ordinal)
+	{
+		// Whole blocks before the ordinal are skipped without decoding them
+		next_block_ = std::partition_point(next_block_, blocks_end_,
+			[ordinal](const PostingBlock& block) { return block.last_ordinal < ordinal; });
+		next_posting_ = LowerBoundPosting(PostingRange(next_posting_, postings_end_), ordinal);
+		LoadNext();
+	}
+	position_ = std::lower_bound(ordinals_ + position_, ordinals_ + size_, ordinal) - ordinals_;
+}
+
+inline double PostingCursor::GetMaxTermFreq(DocumentOrdinal ordinal)
+{
+	if (IsAtEnd())
+	{
+		return 0.;
+	}
+	if (blocks_begin_ == blocks_end_)
+	{
+		return max_term_freq_;
+	}
+	// The loaded block is the one before next_block_, blocks before it hold only smaller ordinals
+	bound_block_ = std::max(bound_block_, next_block_ - 1);
+	while (bound_block_ != blocks_end_ && bound_block_->last_ordinal < ordinal)
+	{
+		++bound_block_;
+	}
+	return bound_block_ == blocks_end_ ? 0. : bound_block_->max_term_freq;
+}
@@ -1,4 +1,5 @@
 #include "search_server.h"
+#include "concurrent_search_server.h"
 #include "request_queue.h"
 #include "read_input_functions.h"
 #include "paginator.h"
@@ -7,10 +8,12 @@
 #include "test_example_functions.h"
 #include "process_queries.h"
 
+#include <chrono>
 #include <iostream>
 #include <random>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 #include <execution>
 
@@ -72,6 +75,44 @@ void Test(string mark, const SearchServer& search_server, const vector<string>&
 
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 
+void TestConcurrentIngest(const string& stop_words, const vector<string>& documents, int thread_count) {
+    ConcurrentSearchServer search_server(stop_words);
+    {
+        LOG_DURATION("ingest, "s + to_string(thread_count) + " threads"s);
+        vector<thread> threads;
+        for (int thread_index = 0; thread_index < thread_count; ++thread_index) {
+            threads.emplace_back([&, thread_index] {
+                for (size_t i = thread_index; i < documents.size(); i += thread_count) {
+                    search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+                }
+            });
+        }
+        for (thread& thread : threads) {
+            thread.join();
+        }
+    }
+    cout << "ingested documents: "s << search_server.GetDocumentCount() << endl;
+}
+
+void TestTokenizer(const vector<string>& documents, int repeat_count) {
+    string text;
+    for (const string& document : documents) {
+        text += document;
+        text.push_back(' ');
+    }
+    vector<string_view> words;
+    size_t word_count = 0;
+    const auto start_time = chrono::steady_clock::now();
+    for (int i = 0; i < repeat_count; ++i) {
+        words.clear();
+        SplitIntoWordsChecked(text, words);
+        word_count += words.size();
+    }
+    const chrono::duration<double> duration = chrono::steady_clock::now() - start_time;
+    cout << "tokenizer words: "s << word_count << endl;
+    cout << "tokenizer: "s << text.size() * repeat_count / duration.count() / 1e9 << " GB/s"s << endl;
+}
+
 void PrintDocument(const Document& document) {
     cout << "{ "s
         << "document_id = "s << document.id << ", "s
@@ -79,7 +120,7 @@ void PrintDocument(const Document& document) {
         << "rating = "s << document.rating << " }"s << endl;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     {
         SearchServer search_server("and with"s);
 
@@ -112,6 +153,23 @@ int main() {
         for (const Document& document : search_server.FindTopDocuments(execution::par, "curly nasty cat"s, [](int document_id, DocumentStatus status, int rating) { return document_id % 2 == 0; })) {
             PrintDocument(document);
         }
+
+        cout << "Even ids, ACTUAL or BANNED:"s << endl;
+        // Compiled filter
+        for (const Document& document : search_server.FindTopDocuments("curly nasty cat"s,
+            DocumentFilter().WithStatuses({ DocumentStatus::ACTUAL, DocumentStatus::BANNED }).WithIdRemainder(2, 0))) {
+            PrintDocument(document);
+        }
+    }
+
+    // An optional corpus file is loaded through the memory-mapped parser
+    if (argc > 1) {
+        SearchServer corpus_server(""s);
+        {
+            LOG_DURATION("corpus load"s);
+            AddDocumentsFromFile(corpus_server, argv[1]);
+        }
+        cout << "corpus documents: "s << corpus_server.GetDocumentCount() << endl;
     }
 
     mt19937 generator;
@@ -128,4 +186,10 @@ int main() {
 
     TEST(seq);
     TEST(par);
+
+    for (const int thread_count : { 1, 2, 4, 8 }) {
+        TestConcurrentIngest(dictionary[0], documents, thread_count);
+    }
+
+    TestTokenizer(documents, 100);
 }
@@ -0,0 +1,267 @@
+#include "mapped_corpus.h"
+
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <execution>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string& path)
+{
+	file_handle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle_ == INVALID_HANDLE_VALUE)
+	{
+		file_handle_ = nullptr;
+		throw runtime_error("cannot open file: "s + path);
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle_, &file_size);
+	size_ = static_cast<size_t>(file_size.QuadPart);
+	if (size_ == 0)
+	{
+		return;
+	}
+	mapping_handle_ = CreateFileMappingA(file_handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data_ = mapping_handle_ ? static_cast<const char*>(MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	if (data_ == nullptr)
+	{
+		Unmap();
+		throw runtime_error("cannot map file: "s + path);
+	}
+}
+
+void MappedFile::Unmap()
+{
+	if (data_ != nullptr)
+	{
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_handle_ != nullptr)
+	{
+		CloseHandle(mapping_handle_);
+	}
+	if (file_handle_ != nullptr)
+	{
+		CloseHandle(file_handle_);
+	}
+	data_ = nullptr;
+	mapping_handle_ = nullptr;
+	file_handle_ = nullptr;
+	size_ = 0;
+}
+
+#else
+
+MappedFile::MappedFile(const string& path)
+{
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		throw runtime_error("cannot open file: "s + path);
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0)
+	{
+		close(fd);
+		throw runtime_error("cannot stat file: "s + path);
+	}
+	size_ = static_cast<size_t>(file_stat.st_size);
+	if (size_ > 0)
+	{
+		void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			throw runtime_error("cannot map file: "s + path);
+		}
+		madvise(data, size_, MADV_SEQUENTIAL);
+		data_ = static_cast<const char*>(data);
+	}
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+}
+
+void MappedFile::Unmap()
+{
+	if (data_ != nullptr)
+	{
+		munmap(const_cast<char*>(data_), size_);
+	}
+	data_ = nullptr;
+	size_ = 0;
+}
+
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Unmap();
+		swap(data_, other.data_);
+		swap(size_, other.size_);
+#ifdef _WIN32
+		swap(file_handle_, other.file_handle_);
+		swap(mapping_handle_, other.mapping_handle_);
+#endif
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	Unmap();
+}
+
+string_view MappedFile::GetData() const
+{
+	return { data_, size_ };
+}
+
+MappedCorpus::MappedCorpus(const string& path)
+	: file_(path), documents_(ParseCorpus(file_.GetData()))
+{
+}
+
+const vector<RawDocument>& MappedCorpus::GetDocuments() const
+{
+	return documents_;
+}
+
+namespace
+{
+	void SkipSpaces(string_view& line)
+	{
+		const size_t pos = line.find_first_not_of(' ');
+		line.remove_prefix(pos == string_view::npos ? line.size() : pos);
+	}
+
+	// The number must be followed by a space or the end of the line, so "3abc" is not read as 3
+	int ParseNumber(string_view& line)
+	{
+		SkipSpaces(line);
+		int value = 0;
+		const auto [end, error] = from_chars(line.data(), line.data() + line.size(), value);
+		if (error != errc() || (end != line.data() + line.size() && *end != ' '))
+		{
+			throw invalid_argument("invalid corpus line");
+		}
+		line.remove_prefix(end - line.data());
+		return value;
+	}
+
+	RawDocument ParseCorpusLine(string_view line)
+	{
+		RawDocument document;
+		document.id = ParseNumber(line);
+		const int status = ParseNumber(line);
+		if (status < static_cast<int>(DocumentStatus::ACTUAL) || status > static_cast<int>(DocumentStatus::REMOVED))
+		{
+			throw invalid_argument("invalid corpus line");
+		}
+		document.status = static_cast<DocumentStatus>(status);
+		// Every rating takes at least one character, which bounds the count before allocating
+		const int ratings_count = ParseNumber(line);
+		if (ratings_count <= 0 || static_cast<size_t>(ratings_count) > line.size())
+		{
+			throw invalid_argument("invalid corpus line");
+		}
+		document.ratings.resize(ratings_count);
+		for (int& rating : document.ratings)
+		{
+			rating = ParseNumber(line);
+		}
+		SkipSpaces(line);
+		document.text = line;
+		return document;
+	}
+
+	void ParseCorpusLines(string_view data, vector<RawDocument>& documents)
+	{
+		while (!data.empty())
+		{
+			const size_t line_end = min(data.find('\n'), data.size());
+			string_view line = data.substr(0, line_end);
+			data.remove_prefix(min(line_end + 1, data.size()));
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.remove_suffix(1);
+			}
+			if (line.find_first_not_of(' ') != string_view::npos)
+			{
+				documents.push_back(ParseCorpusLine(line));
+			}
+		}
+	}
+}
+
+vector<RawDocument> ParseCorpus(string_view data)
+{
+	const size_t chunk_count = max(1u, thread::hardware_concurrency()) * 4;
+	const size_t chunk_size = max<size_t>(data.size() / chunk_count, 1);
+
+	// Chunk borders are moved forward to the next line start
+	vector<string_view> chunks;
+	while (!data.empty())
+	{
+		const size_t newline = data.find('\n', min(chunk_size, data.size()) - 1);
+		const size_t chunk_end = newline == string_view::npos ? data.size() : newline + 1;
+		chunks.push_back(data.substr(0, chunk_end));
+		data.remove_prefix(chunk_end);
+	}
+
+	vector<vector<RawDocument>> chunk_documents(chunks.size());
+	// Exceptions must not escape a parallel algorithm, so they are rethrown afterwards
+	vector<exception_ptr> chunk_errors(chunks.size());
+	vector<size_t> chunk_indexes(chunks.size());
+	iota(chunk_indexes.begin(), chunk_indexes.end(), 0);
+	for_each(execution::par, chunk_indexes.begin(), chunk_indexes.end(),
+		[&](size_t index)
+		{
+			try
+			{
+				ParseCorpusLines(chunks[index], chunk_documents[index]);
+			}
+			catch (...)
+			{
+				chunk_errors[index] = current_exception();
+			}
+		});
+	for (const exception_ptr& error : chunk_errors)
+	{
+		if (error)
+		{
+			rethrow_exception(error);
+		}
+	}
+
+	vector<RawDocument> documents;
+	documents.reserve(transform_reduce(chunk_documents.begin(), chunk_documents.end(), size_t{ 0 }, plus<>(),
+		[](const vector<RawDocument>& chunk) { return chunk.size(); }));
+	for (vector<RawDocument>& chunk : chunk_documents)
+	{
+		move(chunk.begin(), chunk.end(), back_inserter(documents));
+	}
+	return documents;
+}
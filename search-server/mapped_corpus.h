@@ -0,0 +1,54 @@
+#pragma once
+
+#include "document.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	~MappedFile();
+
+	std::string_view GetData() const;
+
+private:
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	void* file_handle_ = nullptr;
+	void* mapping_handle_ = nullptr;
+#endif
+
+	void Unmap();
+};
+
+// Corpus file with one document per line:
+// <id> <status> <ratings count> <rating>... <text>
+// where status is the numeric value of DocumentStatus and there is at least one rating.
+// Texts of the parsed documents are views into the mapping, so they are valid while the corpus is alive
+class MappedCorpus
+{
+public:
+	explicit MappedCorpus(const std::string& path);
+
+	const std::vector<RawDocument>& GetDocuments() const;
+
+private:
+	MappedFile file_;
+	std::vector<RawDocument> documents_;
+};
+
+// Splits the data into newline-aligned chunks and parses them in parallel.
+// Empty lines are skipped, malformed lines throw std::invalid_argument
+std::vector<RawDocument> ParseCorpus(std::string_view data);
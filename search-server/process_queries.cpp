@@ -1,33 +1,84 @@
 #include "process_queries.h"
 
 #include <algorithm>
-#include <execution>
 
 using namespace std;
 
+namespace
+{
+	// Queries per batch: small enough to balance a call over all workers, large enough to keep
+	// the queue traffic negligible next to the queries
+	const size_t MAX_QUERY_BATCH_SIZE = 16;
+
+	size_t GetBatchSize(const QueryExecutor& executor, size_t query_count)
+	{
+		return clamp<size_t>(query_count / (executor.GetWorkerCount() * 4), 1, MAX_QUERY_BATCH_SIZE);
+	}
+}
+
+QueryExecutor& GetSharedQueryExecutor()
+{
+	static QueryExecutor executor;
+	return executor;
+}
+
 vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<string>& queries)
+{
+	return ProcessQueries(GetSharedQueryExecutor(), search_server, queries);
+}
+
+vector<vector<Document>> ProcessQueries(QueryExecutor& executor, const SearchServer& search_server, const vector<string>& queries)
 {
 	vector<vector<Document>> result(queries.size());
-	transform(execution::par, queries.begin(), queries.end(), result.begin(),
-		[&search_server](const string& query) { return move(search_server.FindTopDocuments(query)); });
+	executor.ForEachBatch(queries.size(), GetBatchSize(executor, queries.size()),
+		[&](size_t, size_t first, size_t last)
+		{
+			for (size_t index = first; index < last; ++index)
+			{
+				search_server.FindTopDocuments(queries[index], DocumentStatus::ACTUAL, result[index]);
+			}
+		});
 	return result;
 }
 
-std::list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries)
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries)
 {
-	list<Document> result = transform_reduce(
-		execution::par,
-		queries.begin(), queries.end(),
-		list<Document>(),
-		[](list<Document> lhs, list<Document> rhs)
-		{
-			lhs.splice(lhs.end(), move(rhs));
-			return lhs;
-		},
-		[&search_server](const string& query)
+	return ProcessQueriesJoined(GetSharedQueryExecutor(), search_server, queries);
+}
+
+JoinedDocuments ProcessQueriesJoined(QueryExecutor& executor, const SearchServer& search_server, const vector<string>& queries)
+{
+	// Every query owns a slot of the largest result size in the joined array, so workers write
+	// their results straight into place; the slots are closed up once all sizes are known
+	const size_t slot_size = search_server.GetMaxResultDocumentCount();
+	JoinedDocuments joined;
+	joined.documents.resize(queries.size() * slot_size);
+	joined.offsets.resize(queries.size() + 1, 0);
+	executor.ForEachBatch(queries.size(), GetBatchSize(executor, queries.size()),
+		[&](size_t, size_t first, size_t last)
 		{
-			vector<Document> v_response = search_server.FindTopDocuments(query);
-			return list<Document>(make_move_iterator(v_response.begin()), make_move_iterator(v_response.end()));
+			// Executor workers live between calls, and so does the buffer of every worker
+			thread_local vector<Document> documents;
+			for (size_t index = first; index < last; ++index)
+			{
+				search_server.FindTopDocuments(queries[index], DocumentStatus::ACTUAL, documents);
+				copy(documents.begin(), documents.end(), joined.documents.begin() + index * slot_size);
+				joined.offsets[index + 1] = documents.size();
+			}
 		});
-	return result;
+
+	// offsets[index + 1] holds the size of the result of the query until it is turned into an offset
+	for (size_t index = 0; index < queries.size(); ++index)
+	{
+		const auto slot = joined.documents.begin() + index * slot_size;
+		const size_t count = joined.offsets[index + 1];
+		const auto destination = joined.documents.begin() + joined.offsets[index];
+		if (destination != slot)
+		{
+			copy(slot, slot + count, destination);
+		}
+		joined.offsets[index + 1] = joined.offsets[index] + count;
+	}
+	joined.documents.resize(joined.offsets.back());
+	return joined;
 }
@@ -1,11 +1,37 @@
 #pragma once
 #include "search_server.h"
 #include "document.h"
+#include "paginator.h"
+#include "query_executor.h"
 
 #include <vector>
 #include <string>
-#include <list>
+
+// Top documents of many queries in one array: those of the i-th query are GetDocuments(i)
+struct JoinedDocuments
+{
+	std::vector<Document> documents;
+	// offsets[i] is where the documents of the i-th query begin, the last one is documents.size()
+	std::vector<size_t> offsets{ 0 };
+
+	size_t GetQueryCount() const
+	{
+		return offsets.size() - 1;
+	}
+
+	IteratorRange<const Document*> GetDocuments(size_t index) const
+	{
+		return IteratorRange<const Document*>(documents.data() + offsets[index], documents.data() + offsets[index + 1]);
+	}
+};
+
+// Executor shared by the overloads without one, started on first use
+QueryExecutor& GetSharedQueryExecutor();
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
 
-std::list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+std::vector<std::vector<Document>> ProcessQueries(QueryExecutor& executor, const SearchServer& search_server, const std::vector<std::string>& queries);
+
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+
+JoinedDocuments ProcessQueriesJoined(QueryExecutor& executor, const SearchServer& search_server, const std::vector<std::string>& queries);
@@ -0,0 +1,89 @@
+#include "query_cache.h"
+
+#include <algorithm>
+
+using namespace std;
+
+bool QueryCache::Key::operator==(const Key& other) const
+{
+	return plus_terms == other.plus_terms && minus_terms == other.minus_terms && filter_type == other.filter_type &&
+		status == other.status && top_count == other.top_count;
+}
+
+size_t QueryCache::KeyHasher::operator()(const Key& key) const
+{
+	uint64_t hash = key.filter_type.hash_code() ^ (static_cast<uint64_t>(key.status) << 32) ^ key.top_count;
+	auto mix = [&hash](uint64_t value)
+	{
+		hash = (hash ^ value) * 0x100000001B3ull;
+	};
+	for (const TermId term_id : key.plus_terms)
+	{
+		mix(term_id);
+	}
+	// Separates plus and minus terms, so moving a word between them changes the hash
+	mix(TermDictionary::NO_TERM);
+	for (const TermId term_id : key.minus_terms)
+	{
+		mix(term_id);
+	}
+	return static_cast<size_t>(hash * 0x9E3779B97F4A7C15ull);
+}
+
+QueryCache::QueryCache(size_t capacity)
+	: shard_capacity_(max<size_t>((capacity + SHARD_COUNT - 1) / SHARD_COUNT, 1))
+{
+}
+
+QueryCache::Shard& QueryCache::GetShard(size_t hash)
+{
+	return shards_[(hash >> 32) % SHARD_COUNT];
+}
+
+optional<vector<Document>> QueryCache::Find(const Key& key, uint64_t generation)
+{
+	Shard& shard = GetShard(hasher_(key));
+	lock_guard guard(shard.mutex);
+	const auto it = shard.positions.find(key);
+	if (it == shard.positions.end() || it->second->generation != generation)
+	{
+		++shard.stats.misses;
+		return nullopt;
+	}
+	++shard.stats.hits;
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	return it->second->documents;
+}
+
+void QueryCache::Insert(const Key& key, uint64_t generation, const vector<Document>& documents)
+{
+	Shard& shard = GetShard(hasher_(key));
+	lock_guard guard(shard.mutex);
+	const auto it = shard.positions.find(key);
+	if (it != shard.positions.end())
+	{
+		it->second->generation = generation;
+		it->second->documents = documents;
+		shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+		return;
+	}
+	if (shard.entries.size() >= shard_capacity_)
+	{
+		shard.positions.erase(shard.entries.back().key);
+		shard.entries.pop_back();
+	}
+	shard.entries.push_front({ key, generation, documents });
+	shard.positions.emplace(key, shard.entries.begin());
+}
+
+QueryCacheStats QueryCache::GetStats() const
+{
+	QueryCacheStats stats;
+	for (const Shard& shard : shards_)
+	{
+		lock_guard guard(shard.mutex);
+		stats.hits += shard.stats.hits;
+		stats.misses += shard.stats.misses;
+	}
+	return stats;
+}
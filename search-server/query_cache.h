@@ -0,0 +1,77 @@
+#pragma once
+
+#include "document.h"
+#include "term_dictionary.h"
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+struct QueryCacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+};
+
+// Bounded cache of top documents split into independently locked LRU shards.
+// Entries remember the index generation they were computed for and are ignored once it changes
+class QueryCache
+{
+public:
+	// Normalized query: sorted unique term ids, the documents filter and the result size.
+	// A filter is a status (filter_type is DocumentStatus) or the type of a stateless predicate
+	struct Key
+	{
+		std::vector<TermId> plus_terms;
+		std::vector<TermId> minus_terms;
+		std::type_index filter_type;
+		DocumentStatus status;
+		size_t top_count;
+
+		bool operator==(const Key& other) const;
+	};
+
+	explicit QueryCache(size_t capacity);
+
+	std::optional<std::vector<Document>> Find(const Key& key, uint64_t generation);
+
+	void Insert(const Key& key, uint64_t generation, const std::vector<Document>& documents);
+
+	QueryCacheStats GetStats() const;
+
+private:
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+	static constexpr size_t SHARD_COUNT = 16;
+
+	struct KeyHasher
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		uint64_t generation;
+		std::vector<Document> documents;
+	};
+
+	// Most recently used entries are at the front of the list
+	struct alignas(CACHE_LINE_SIZE) Shard
+	{
+		mutable std::mutex mutex;
+		std::list<Entry> entries;
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHasher> positions;
+		QueryCacheStats stats;
+	};
+
+	size_t shard_capacity_;
+	KeyHasher hasher_;
+	std::array<Shard, SHARD_COUNT> shards_;
+
+	Shard& GetShard(size_t hash);
+};
@@ -0,0 +1,147 @@
+#include "query_executor.h"
+
+#include <algorithm>
+
+using namespace std;
+
+QueryExecutor::QueryExecutor(size_t worker_count)
+{
+	worker_count = max<size_t>(worker_count, 1);
+	queues_.reserve(worker_count);
+	for (size_t index = 0; index < worker_count; ++index)
+	{
+		queues_.push_back(make_unique<WorkerQueue>());
+	}
+	workers_.reserve(worker_count);
+	for (size_t index = 0; index < worker_count; ++index)
+	{
+		workers_.emplace_back([this, index]() { RunWorker(index); });
+	}
+}
+
+QueryExecutor::~QueryExecutor()
+{
+	{
+		lock_guard lock(wake_mutex_);
+		is_stopping_ = true;
+	}
+	wake_.notify_all();
+	for (thread& worker : workers_)
+	{
+		worker.join();
+	}
+}
+
+size_t QueryExecutor::GetWorkerCount() const
+{
+	return workers_.size();
+}
+
+void QueryExecutor::ForEachBatch(size_t count, size_t batch_size, const BatchTask& task)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	batch_size = max<size_t>(batch_size, 1);
+	const size_t batch_count = (count + batch_size - 1) / batch_size;
+	Job job;
+	job.task = &task;
+	job.remaining_batches = batch_count;
+
+	// Counted before they are queued, so that taking one never brings the count below zero
+	{
+		lock_guard lock(wake_mutex_);
+		pending_batches_ += batch_count;
+	}
+	// Consecutive batches go to different workers, so every worker starts on its own share
+	const size_t worker_count = queues_.size();
+	for (size_t worker_index = 0; worker_index < min(worker_count, batch_count); ++worker_index)
+	{
+		WorkerQueue& queue = *queues_[worker_index];
+		lock_guard lock(queue.mutex);
+		for (size_t batch_index = worker_index; batch_index < batch_count; batch_index += worker_count)
+		{
+			queue.batches.push_back({ &job, batch_index * batch_size, min(count, (batch_index + 1) * batch_size) });
+		}
+	}
+	wake_.notify_all();
+
+	unique_lock lock(job.mutex);
+	job.done.wait(lock, [&job]() { return job.remaining_batches == 0; });
+	if (job.error)
+	{
+		rethrow_exception(job.error);
+	}
+}
+
+void QueryExecutor::RunWorker(size_t worker_index)
+{
+	Batch batch;
+	while (true)
+	{
+		if (TryTakeBatch(worker_index, batch))
+		{
+			RunBatch(worker_index, batch);
+			continue;
+		}
+		unique_lock lock(wake_mutex_);
+		wake_.wait(lock, [this]() { return is_stopping_ || pending_batches_ > 0; });
+		if (is_stopping_)
+		{
+			return;
+		}
+	}
+}
+
+bool QueryExecutor::TryTakeBatch(size_t worker_index, Batch& batch)
+{
+	const size_t worker_count = queues_.size();
+	for (size_t offset = 0; offset < worker_count; ++offset)
+	{
+		WorkerQueue& queue = *queues_[(worker_index + offset) % worker_count];
+		lock_guard lock(queue.mutex);
+		if (queue.batches.empty())
+		{
+			continue;
+		}
+		// The owner takes the oldest batch, a thief the newest one, so they rarely meet
+		if (offset == 0)
+		{
+			batch = queue.batches.front();
+			queue.batches.pop_front();
+		}
+		else
+		{
+			batch = queue.batches.back();
+			queue.batches.pop_back();
+		}
+		--pending_batches_;
+		return true;
+	}
+	return false;
+}
+
+void QueryExecutor::RunBatch(size_t worker_index, const Batch& batch)
+{
+	Job& job = *batch.job;
+	try
+	{
+		(*job.task)(worker_index, batch.first, batch.last);
+	}
+	catch (...)
+	{
+		lock_guard lock(job.mutex);
+		if (!job.error)
+		{
+			job.error = current_exception();
+		}
+	}
+	// The caller may destroy the job as soon as it sees no batches left, so the count changes
+	// under the lock and nothing touches the job after the unlock
+	lock_guard lock(job.mutex);
+	if (--job.remaining_batches == 0)
+	{
+		job.done.notify_one();
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of workers with work stealing. A call splits its indexes into batches and deals
+// them out to the workers' queues; a worker takes batches from the front of its own queue and,
+// once it is empty, steals from the back of the others. Workers live as long as the executor,
+// so per-thread buffers they use stay allocated between calls
+class QueryExecutor
+{
+public:
+	// Called with the index of the worker, in [0, GetWorkerCount()), and a range of indexes
+	using BatchTask = std::function<void(size_t worker_index, size_t first, size_t last)>;
+
+	explicit QueryExecutor(size_t worker_count = std::max(1u, std::thread::hardware_concurrency()));
+
+	QueryExecutor(const QueryExecutor&) = delete;
+	QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+	~QueryExecutor();
+
+	size_t GetWorkerCount() const;
+
+	// Runs task over consecutive ranges of at most batch_size indexes covering [0, count) and waits for them.
+	// Rethrows the first exception a task threw. May be called from several threads at once, not from a task
+	void ForEachBatch(size_t count, size_t batch_size, const BatchTask& task);
+
+private:
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+	// Lives on the stack of the calling thread until its last batch is done
+	struct Job
+	{
+		const BatchTask* task = nullptr;
+		// Guarded by mutex
+		size_t remaining_batches = 0;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::exception_ptr error;
+	};
+
+	struct Batch
+	{
+		Job* job;
+		size_t first;
+		size_t last;
+	};
+
+	struct alignas(CACHE_LINE_SIZE) WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Batch> batches;
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues_;
+	std::vector<std::thread> workers_;
+	// Batches queued and not taken yet, raised under wake_mutex_ so that no wake-up is lost
+	std::atomic<size_t> pending_batches_{ 0 };
+	std::mutex wake_mutex_;
+	std::condition_variable wake_;
+	bool is_stopping_ = false;
+
+	void RunWorker(size_t worker_index);
+
+	bool TryTakeBatch(size_t worker_index, Batch& batch);
+
+	static void RunBatch(size_t worker_index, const Batch& batch);
+};
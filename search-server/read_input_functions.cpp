@@ -1,4 +1,6 @@
 #include "read_input_functions.h"
+#include "mapped_corpus.h"
+
 #include <iostream>
 
 
@@ -29,3 +31,10 @@ std::vector<int> ReadRatingsLine()
 	ReadLine();
 	return result;
 }
+
+void AddDocumentsFromFile(SearchServer& search_server, const std::string& path)
+{
+	// The index keeps its own copies of the words, so the mapping can go once they are added
+	const MappedCorpus corpus(path);
+	search_server.AddDocuments(corpus.GetDocuments());
+}
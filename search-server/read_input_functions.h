@@ -1,4 +1,6 @@
 #pragma once
+#include "search_server.h"
+
 #include <string>
 #include <vector>
 
@@ -8,3 +10,6 @@ std::string ReadLine();
 int ReadLineWithNumber();
 
 std::vector<int> ReadRatingsLine();
+
+// Adds every document of a corpus file in the MappedCorpus format to search_server as one batch
+void AddDocumentsFromFile(SearchServer& search_server, const std::string& path);
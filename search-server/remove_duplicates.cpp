@@ -1,32 +1,256 @@
 #include "remove_duplicates.h"
 #include "search_server.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <execution>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
 using namespace std;
 
-void RemoveDuplicates(SearchServer& search_server)
+namespace
 {
-	set<vector<string_view>> documents;
-	set<int> ids_to_remove;
-	for (const int document_id : search_server)
+	struct Fingerprint
 	{
-		vector<string_view> words;
-		for (const auto& [word, _freq] : search_server.GetWordFrequencies(document_id))
+		uint64_t low = 0;
+		uint64_t high = 0;
+
+		bool operator<(const Fingerprint& other) const
 		{
-			words.push_back(word);
+			return tie(low, high) < tie(other.low, other.high);
 		}
-		if (documents.find(words) != documents.end())
+
+		bool operator==(const Fingerprint& other) const
 		{
-			ids_to_remove.insert(document_id);
+			return low == other.low && high == other.high;
 		}
-		else
+	};
+
+	// Finalizer of SplitMix64, every input bit affects every output bit
+	uint64_t Mix(uint64_t value)
+	{
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+		return value ^ (value >> 31);
+	}
+
+	// The halves are chained with different constants, so they collide independently
+	Fingerprint ComputeFingerprint(const SearchServer& search_server, int document_id)
+	{
+		Fingerprint fingerprint{ 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full };
+		search_server.ForEachDocumentTerm(document_id, [&fingerprint](TermId term_id)
+			{
+				fingerprint.low = Mix(fingerprint.low ^ term_id);
+				fingerprint.high = Mix(fingerprint.high + term_id * 0xFF51AFD7ED558CCDull);
+			});
+		return fingerprint;
+	}
+
+	void GetDocumentTerms(const SearchServer& search_server, int document_id, vector<TermId>& terms)
+	{
+		terms.clear();
+		search_server.ForEachDocumentTerm(document_id, [&terms](TermId term_id) { terms.push_back(term_id); });
+	}
+
+	vector<TermId> GetDocumentTerms(const SearchServer& search_server, int document_id)
+	{
+		vector<TermId> terms;
+		GetDocumentTerms(search_server, document_id, terms);
+		return terms;
+	}
+
+	const size_t MIN_HASH_COUNT = 64;
+
+	// The i-th hash of a term is low + i * high of one mixed value, which is as good for MinHash
+	// as independent hash functions and costs an addition per hash
+	void ComputeSignature(const SearchServer& search_server, int document_id, uint64_t* signature)
+	{
+		fill(signature, signature + MIN_HASH_COUNT, UINT64_MAX);
+		search_server.ForEachDocumentTerm(document_id, [signature](TermId term_id)
+			{
+				const uint64_t low = Mix(term_id);
+				const uint64_t high = Mix(low) | 1;
+				for (size_t index = 0; index < MIN_HASH_COUNT; ++index)
+				{
+					signature[index] = min(signature[index], low + index * high);
+				}
+			});
+	}
+
+	// A pair with similarity s shares a band with probability 1 - (1 - s^rows)^bands, which rises
+	// steeply around (1 / bands)^(1 / rows). Picks the split that puts this point nearest to the threshold
+	size_t GetBandRowCount(double similarity_threshold)
+	{
+		size_t best_rows = 1;
+		double best_distance = 2.;
+		for (size_t rows = 1; rows <= MIN_HASH_COUNT; ++rows)
+		{
+			const double bands = static_cast<double>(MIN_HASH_COUNT / rows);
+			const double distance = abs(pow(1. / bands, 1. / rows) - similarity_threshold);
+			if (distance < best_distance)
+			{
+				best_rows = rows;
+				best_distance = distance;
+			}
+		}
+		return best_rows;
+	}
+
+	// Both ranges are sorted and without repeats
+	double ComputeJaccardSimilarity(const vector<TermId>& lhs, const vector<TermId>& rhs)
+	{
+		if (lhs.empty() && rhs.empty())
+		{
+			return 1.;
+		}
+		size_t common_count = 0;
+		for (auto lhs_it = lhs.begin(), rhs_it = rhs.begin(); lhs_it != lhs.end() && rhs_it != rhs.end();)
+		{
+			if (*lhs_it < *rhs_it)
+			{
+				++lhs_it;
+			}
+			else if (*rhs_it < *lhs_it)
+			{
+				++rhs_it;
+			}
+			else
+			{
+				++common_count;
+				++lhs_it;
+				++rhs_it;
+			}
+		}
+		return static_cast<double>(common_count) / (lhs.size() + rhs.size() - common_count);
+	}
+}
+
+vector<int> RemoveDuplicates(SearchServer& search_server)
+{
+	const vector<int> document_ids(search_server.begin(), search_server.end());
+	vector<Fingerprint> fingerprints(document_ids.size());
+	transform(execution::par, document_ids.begin(), document_ids.end(), fingerprints.begin(),
+		[&search_server](int document_id) { return ComputeFingerprint(search_server, document_id); });
+
+	// Sorting by fingerprint keeps ids ascending within a group, since document_ids is sorted
+	vector<size_t> order(document_ids.size());
+	iota(order.begin(), order.end(), 0);
+	sort(execution::par, order.begin(), order.end(),
+		[&fingerprints](size_t lhs, size_t rhs) { return tie(fingerprints[lhs], lhs) < tie(fingerprints[rhs], rhs); });
+
+	vector<int> removed_ids;
+	for (auto group_begin = order.begin(); group_begin != order.end();)
+	{
+		const auto group_end = find_if(group_begin + 1, order.end(),
+			[&](size_t index) { return !(fingerprints[index] == fingerprints[*group_begin]); });
+		if (group_end - group_begin > 1)
 		{
-			documents.insert(words);
+			// Almost always one set of terms, the others are hash collisions and are kept
+			vector<vector<TermId>> kept_terms;
+			for (auto it = group_begin; it != group_end; ++it)
+			{
+				vector<TermId> terms = GetDocumentTerms(search_server, document_ids[*it]);
+				if (find(kept_terms.begin(), kept_terms.end(), terms) != kept_terms.end())
+				{
+					removed_ids.push_back(document_ids[*it]);
+				}
+				else
+				{
+					kept_terms.push_back(move(terms));
+				}
+			}
 		}
+		group_begin = group_end;
+	}
+
+	sort(removed_ids.begin(), removed_ids.end());
+	search_server.RemoveDocuments(removed_ids);
+	return removed_ids;
+}
+
+vector<int> RemoveNearDuplicates(SearchServer& search_server, double similarity_threshold)
+{
+	if (!(similarity_threshold > 0. && similarity_threshold <= 1.))
+	{
+		throw invalid_argument("similarity threshold must be in (0, 1]");
 	}
+	const size_t rows = GetBandRowCount(similarity_threshold);
+	const size_t band_count = MIN_HASH_COUNT / rows;
 
-	for (int id : ids_to_remove)
+	// Band keys of every document, computed in parallel from its signature
+	const vector<int> document_ids(search_server.begin(), search_server.end());
+	vector<uint64_t> band_keys(document_ids.size() * band_count);
+	vector<size_t> indexes(document_ids.size());
+	iota(indexes.begin(), indexes.end(), 0);
+	for_each(execution::par, indexes.begin(), indexes.end(),
+		[&](size_t index)
+		{
+			uint64_t signature[MIN_HASH_COUNT];
+			ComputeSignature(search_server, document_ids[index], signature);
+			for (size_t band = 0; band < band_count; ++band)
+			{
+				uint64_t key = Mix(band);
+				for (size_t row = 0; row < rows; ++row)
+				{
+					key = Mix(key ^ signature[band * rows + row]);
+				}
+				band_keys[index * band_count + band] = key;
+			}
+		});
+
+	// Documents are decided in id order against the kept documents sharing a band with them,
+	// so a cluster of near duplicates leaves one document in the buckets
+	unordered_map<uint64_t, vector<size_t>> kept_documents;
+	vector<size_t> candidates;
+	vector<TermId> terms;
+	vector<TermId> candidate_terms;
+	vector<int> removed_ids;
+	for (size_t index = 0; index < document_ids.size(); ++index)
 	{
-		search_server.RemoveDocument(id);
-		cout << "Found duplicate document id " << id << "\n";
+		const uint64_t* keys = band_keys.data() + index * band_count;
+		candidates.clear();
+		for (size_t band = 0; band < band_count; ++band)
+		{
+			if (const auto it = kept_documents.find(keys[band]); it != kept_documents.end())
+			{
+				candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+		candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+		bool is_duplicate = false;
+		if (!candidates.empty())
+		{
+			GetDocumentTerms(search_server, document_ids[index], terms);
+			for (const size_t candidate : candidates)
+			{
+				GetDocumentTerms(search_server, document_ids[candidate], candidate_terms);
+				if (ComputeJaccardSimilarity(terms, candidate_terms) >= similarity_threshold)
+				{
+					is_duplicate = true;
+					break;
+				}
+			}
+		}
+
+		if (is_duplicate)
+		{
+			removed_ids.push_back(document_ids[index]);
+		}
+		else
+		{
+			for (size_t band = 0; band < band_count; ++band)
+			{
+				kept_documents[keys[band]].push_back(index);
+			}
+		}
 	}
-}
\ No newline at end of file
+
+	search_server.RemoveDocuments(removed_ids);
+	return removed_ids;
+}
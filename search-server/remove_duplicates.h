@@ -1,4 +1,15 @@
 #pragma once
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+#include <vector>
+
+// Removes every document whose set of words equals the one of a document with a smaller id.
+// Documents are compared by 128-bit fingerprints of their term sets computed in parallel,
+// and documents with equal fingerprints are compared term by term. Returns the removed ids, sorted
+std::vector<int> RemoveDuplicates(SearchServer& search_server);
+
+// Removes every document whose set of words has a Jaccard similarity of at least similarity_threshold
+// with the set of a smaller-id document that is kept. Candidates are found by LSH banding of MinHash
+// signatures computed in parallel, then checked exactly. Returns the removed ids, sorted.
+// Throws std::invalid_argument if the threshold is not in (0, 1]
+std::vector<int> RemoveNearDuplicates(SearchServer& search_server, double similarity_threshold = 0.8);
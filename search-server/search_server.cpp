@@ -3,10 +3,15 @@
 #include "document.h"
 #include "log_duration.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <execution>
 #include <stdexcept>
 #include <cmath>
+#include <limits>
+#include <numeric>
 #include <string_view>
+#include <unordered_set>
 
 using namespace std;
 
@@ -34,16 +39,32 @@ bool SearchServer::IsStopWord(string_view word) const
 	return stop_words_.count(word);
 }
 
-vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const
+bool SearchServer::SplitIntoWordsNoStop(string_view text, vector<string_view>& words) const
 {
-	vector<string_view> words;
-	for (string_view word : SplitIntoWordsView(text))
+	words.clear();
+	const bool is_valid = SplitIntoWordsChecked(text, words);
+	if (!stop_words_.empty())
 	{
-		if (!IsStopWord(word))
-		{
-			words.push_back(word);
-		}
+		words.erase(remove_if(words.begin(), words.end(), [this](string_view word) { return IsStopWord(word); }), words.end());
 	}
+	return is_valid;
+}
+
+const vector<string_view>& SearchServer::SplitQuery(string_view query) const
+{
+	vector<string_view>& words = GetWordBuffer();
+	if (!SplitIntoWordsNoStop(query, words))
+	{
+		// Stop words are valid, so the offending word is still among the words
+		const auto it = find_if_not(words.begin(), words.end(), IsValidWord);
+		throw invalid_argument("invalid word: "s + string{ it == words.end() ? query : *it });
+	}
+	return words;
+}
+
+vector<string_view>& SearchServer::GetWordBuffer()
+{
+	thread_local vector<string_view> words;
 	return words;
 }
 
@@ -53,10 +74,6 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const
 	{
 		throw invalid_argument("invalid query");
 	}
-	if (!IsValidWord(word))
-	{
-		throw invalid_argument("invalid word: "s + string{ word });
-	}
 	bool is_minus = false;
 	if (word[0] == '-') {
 		is_minus = true;
@@ -67,32 +84,295 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const
 
 SearchServer::Query SearchServer::ParseQuery(string_view query, bool do_unique) const
 {
-	Query query_words;
-	for (string_view word : SplitIntoWordsNoStop(query))
+	Query query_terms;
+	ParseQuery(query, query_terms, do_unique);
+	return query_terms;
+}
+
+void SearchServer::ParseQuery(string_view query, Query& query_terms, bool do_unique) const
+{
+	query_terms.plus_terms.clear();
+	query_terms.minus_terms.clear();
+	query_terms.plus_idfs.clear();
+	for (string_view word : SplitQuery(query))
 	{
 		const QueryWord query_word = ParseQueryWord(word);
+		const TermId term_id = terms_.Find(query_word.word);
+		if (term_id == TermDictionary::NO_TERM)
+		{
+			continue;
+		}
 		if (query_word.is_minus)
 		{
-			query_words.minus_words.push_back(query_word.word);
+			query_terms.minus_terms.push_back(term_id);
 		}
 		else
 		{
-			query_words.plus_words.push_back(query_word.word);
+			query_terms.plus_terms.push_back(term_id);
 		}
 	}
 	if (do_unique)
 	{
-		std::sort(query_words.minus_words.begin(), query_words.minus_words.end());
-		query_words.minus_words.erase(unique(query_words.minus_words.begin(), query_words.minus_words.end()), query_words.minus_words.end());
-		std::sort(query_words.plus_words.begin(), query_words.plus_words.end());
-		query_words.plus_words.erase(unique(query_words.plus_words.begin(), query_words.plus_words.end()), query_words.plus_words.end());
+		NormalizeQuery(query_terms);
+	}
+}
+
+void SearchServer::NormalizeQuery(Query& query_terms) const
+{
+	std::sort(query_terms.minus_terms.begin(), query_terms.minus_terms.end());
+	query_terms.minus_terms.erase(unique(query_terms.minus_terms.begin(), query_terms.minus_terms.end()), query_terms.minus_terms.end());
+	std::sort(query_terms.plus_terms.begin(), query_terms.plus_terms.end());
+	query_terms.plus_terms.erase(unique(query_terms.plus_terms.begin(), query_terms.plus_terms.end()), query_terms.plus_terms.end());
+
+	query_terms.plus_idfs.resize(query_terms.plus_terms.size());
+	transform(query_terms.plus_terms.begin(), query_terms.plus_terms.end(), query_terms.plus_idfs.begin(),
+		[this](TermId term_id) { return idf_table_.GetIDF(term_id); });
+}
+
+SearchServer::Query SearchServer::ResolveQuery(const PreparedQuery& prepared_query) const
+{
+	Query query_terms;
+	for (const string& word : prepared_query.plus_words_)
+	{
+		if (const TermId term_id = terms_.Find(word); term_id != TermDictionary::NO_TERM)
+		{
+			query_terms.plus_terms.push_back(term_id);
+		}
 	}
-	return query_words;
+	for (const string& word : prepared_query.minus_words_)
+	{
+		if (const TermId term_id = terms_.Find(word); term_id != TermDictionary::NO_TERM)
+		{
+			query_terms.minus_terms.push_back(term_id);
+		}
+	}
+	NormalizeQuery(query_terms);
+	return query_terms;
+}
+
+void SearchServer::ApplyQueryStatistics(const QueryStatistics& statistics, Query& query_terms) const
+{
+	const double log_document_count = log(static_cast<double>(statistics.document_count));
+	for (size_t term_index = 0; term_index < query_terms.plus_terms.size(); ++term_index)
+	{
+		const string_view word = terms_.GetTerm(query_terms.plus_terms[term_index]);
+		const auto it = lower_bound(statistics.plus_words.begin(), statistics.plus_words.end(), word);
+		if (it == statistics.plus_words.end() || *it != word)
+		{
+			throw invalid_argument("statistics of another query");
+		}
+		query_terms.plus_idfs[term_index] = log_document_count - log(static_cast<double>(statistics.document_freqs[it - statistics.plus_words.begin()]));
+	}
+}
+
+shared_ptr<const SearchServer::Query> SearchServer::GetPreparedTerms(const PreparedQuery& prepared_query) const
+{
+	using ResolvedQuery = PreparedQuery::ResolvedQuery;
+	shared_ptr<const ResolvedQuery> resolved = atomic_load(&prepared_query.resolved_);
+	if (!resolved || resolved->generation != generation_.Get())
+	{
+		resolved = make_shared<const ResolvedQuery>(ResolvedQuery{ ResolveQuery(prepared_query), generation_.Get() });
+		atomic_store(&prepared_query.resolved_, resolved);
+	}
+	return shared_ptr<const Query>(resolved, &resolved->query);
+}
+
+SearchServer::PreparedQuery SearchServer::PrepareQuery(string_view query) const
+{
+	PreparedQuery prepared_query;
+	for (string_view word : SplitQuery(query))
+	{
+		const QueryWord query_word = ParseQueryWord(word);
+		(query_word.is_minus ? prepared_query.minus_words_ : prepared_query.plus_words_).emplace_back(query_word.word);
+	}
+	for (vector<string>* words : { &prepared_query.plus_words_, &prepared_query.minus_words_ })
+	{
+		sort(words->begin(), words->end());
+		words->erase(unique(words->begin(), words->end()), words->end());
+	}
+	GetPreparedTerms(prepared_query);
+	return prepared_query;
+}
+
+SearchServer::PreparedQuery::PreparedQuery(const PreparedQuery& other)
+	: plus_words_(other.plus_words_), minus_words_(other.minus_words_), resolved_(atomic_load(&other.resolved_))
+{
+}
+
+SearchServer::PreparedQuery& SearchServer::PreparedQuery::operator=(const PreparedQuery& other)
+{
+	plus_words_ = other.plus_words_;
+	minus_words_ = other.minus_words_;
+	atomic_store(&resolved_, atomic_load(&other.resolved_));
+	return *this;
+}
+
+bool SearchServer::IsMoreRelevant(const Document& lhs, const Document& rhs)
+{
+	if (abs(lhs.relevance - rhs.relevance) < RELEVANCE_EPSILON)
+	{
+		return lhs.rating > rhs.rating;
+	}
+	return lhs.relevance > rhs.relevance;
+}
+
+size_t SearchServer::FindSegmentIndex(DocumentOrdinal ordinal) const
+{
+	const auto it = upper_bound(segments_.begin(), segments_.end(), ordinal,
+		[](DocumentOrdinal value, const shared_ptr<const IndexSegment>& segment) { return value < segment->GetFirstOrdinal(); });
+	return it - segments_.begin() - 1;
+}
+
+bool SearchServer::HasPosting(TermId term_id, DocumentOrdinal ordinal) const
+{
+	if (ordinal >= write_first_ordinal_)
+	{
+		const PostingList& postings = write_postings_[term_id];
+		return ContainsPosting(PostingRange(postings.data(), postings.data() + postings.size()), ordinal);
+	}
+	PostingCursor cursor(segments_[FindSegmentIndex(ordinal)]->GetTermPostings(term_id));
+	cursor.Seek(ordinal);
+	return !cursor.IsAtEnd() && cursor.GetOrdinal() == ordinal;
+}
+
+void SearchServer::AppendPosting(TermId term_id, const Posting& posting)
+{
+	PostingList& postings = write_postings_[term_id];
+	if (postings.empty())
+	{
+		write_terms_.push_back(term_id);
+	}
+	// New ordinals are the largest ones, so appending keeps posting lists sorted
+	postings.push_back(posting);
+	idf_table_.AddDocuments(term_id, 1);
+}
+
+DocumentOrdinal SearchServer::GetOrdinal(int document_id) const
+{
+	return document_ordinals_.at(document_id);
+}
+
+SearchServer::TopDocumentCollector::TopDocumentCollector(size_t top_count, vector<double>& top_relevances, vector<Document>& candidates)
+	: top_count_(top_count), top_relevances_(top_relevances), candidates_(candidates),
+	threshold_(top_count > 0 ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity())
+{
+	top_relevances_.clear();
+	candidates_.clear();
 }
 
-double SearchServer::ComputeWordIDF(string_view word) const
+double SearchServer::TopDocumentCollector::GetThreshold() const
 {
-	return log(static_cast<double>(GetDocumentCount()) / word_to_documents_freqs_.at(word).size());
+	return threshold_;
+}
+
+void SearchServer::TopDocumentCollector::Add(const Document& document)
+{
+	if (document.relevance < threshold_)
+	{
+		return;
+	}
+	candidates_.push_back(document);
+	top_relevances_.push_back(document.relevance);
+	push_heap(top_relevances_.begin(), top_relevances_.end(), greater<double>());
+	if (top_relevances_.size() > top_count_)
+	{
+		pop_heap(top_relevances_.begin(), top_relevances_.end(), greater<double>());
+		top_relevances_.pop_back();
+	}
+	if (top_relevances_.size() == top_count_)
+	{
+		threshold_ = top_relevances_.front() - 2 * RELEVANCE_EPSILON;
+	}
+	if (candidates_.size() >= 4 * top_count_ + 64)
+	{
+		DropBelowThreshold();
+	}
+}
+
+void SearchServer::TopDocumentCollector::Finish(vector<Document>& documents)
+{
+	DropBelowThreshold();
+	documents.insert(documents.end(), candidates_.begin(), candidates_.end());
+}
+
+void SearchServer::TopDocumentCollector::DropBelowThreshold()
+{
+	candidates_.erase(remove_if(candidates_.begin(), candidates_.end(),
+		[this](const Document& document) { return document.relevance < threshold_; }), candidates_.end());
+}
+
+SearchServer::ScratchLease::ScratchLease()
+{
+	ScratchPool& pool = GetPool();
+	if (pool.lease_count == pool.scratches.size())
+	{
+		pool.scratches.push_back(make_unique<SearchScratch>());
+	}
+	scratch_ = pool.scratches[pool.lease_count++].get();
+}
+
+SearchServer::ScratchLease::~ScratchLease()
+{
+	--GetPool().lease_count;
+}
+
+SearchServer::SearchScratch& SearchServer::ScratchLease::Get() const
+{
+	return *scratch_;
+}
+
+SearchServer::ScratchLease::ScratchPool& SearchServer::ScratchLease::GetPool()
+{
+	thread_local ScratchPool pool;
+	return pool;
+}
+
+TermPostings SearchServer::GetWriteTermPostings(TermId term_id) const
+{
+	const PostingList& postings = write_postings_[term_id];
+	TermPostings term_postings;
+	term_postings.postings = PostingRange(postings.data(), postings.data() + postings.size());
+	term_postings.document_sizes = document_sizes_.data();
+	for (const Posting& posting : postings)
+	{
+		term_postings.max_term_freq = max(term_postings.max_term_freq,
+			static_cast<double>(posting.term_count) / document_sizes_[posting.ordinal]);
+	}
+	return term_postings;
+}
+
+SearchServer::Generation::Generation()
+	: value_(Next())
+{
+}
+
+SearchServer::Generation::Generation(Generation&& other) noexcept
+	: value_(other.value_)
+{
+	other.Advance();
+}
+
+SearchServer::Generation& SearchServer::Generation::operator=(Generation&& other) noexcept
+{
+	value_ = other.value_;
+	other.Advance();
+	return *this;
+}
+
+void SearchServer::Generation::Advance()
+{
+	value_ = Next();
+}
+
+uint64_t SearchServer::Generation::Get() const
+{
+	return value_;
+}
+
+uint64_t SearchServer::Generation::Next()
+{
+	static atomic<uint64_t> last_generation{ 0 };
+	return ++last_generation;
 }
 
 SearchServer::SearchServer() = default;
@@ -109,7 +389,17 @@ SearchServer::SearchServer(std::string_view stop_words)
 
 int SearchServer::GetDocumentCount() const
 {
-	return documents_.size();
+	return document_ordinals_.size();
+}
+
+size_t SearchServer::GetMaxResultDocumentCount() const
+{
+	return max_result_document_count_;
+}
+
+void SearchServer::SetMaxResultDocumentCount(size_t max_result_document_count)
+{
+	max_result_document_count_ = max_result_document_count;
 }
 
 set<int>::const_iterator SearchServer::begin() const
@@ -122,36 +412,340 @@ set<int>::const_iterator SearchServer::end() const
 	return docs_ids_.cend();
 }
 
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const
+map<string_view, double> SearchServer::GetWordFrequencies(int document_id) const
 {
-	if (document_to_words_freqs_.find(document_id) == document_to_words_freqs_.end())
+	map<string_view, double> words_freqs;
+	const auto it = document_ordinals_.find(document_id);
+	if (it != document_ordinals_.end())
 	{
-		static const map<string_view, double> dummy;
-		return dummy;
-	}
-	else
-	{
-		return document_to_words_freqs_.at(document_id);
+		for (const auto [term_id, count] : document_term_counts_[it->second])
+		{
+			words_freqs.emplace(terms_.GetTerm(term_id), static_cast<double>(count) / document_sizes_[it->second]);
+		}
 	}
+	return words_freqs;
 }
 
 void SearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings)
 {
 
-	if (document_id < 0 || documents_.count(document_id) > 0 || !IsValidWord(document))
+	vector<string_view>& document_words = GetWordBuffer();
+	if (document_id < 0 || document_ordinals_.count(document_id) > 0 || !SplitIntoWordsNoStop(document, document_words))
 	{
 		throw invalid_argument("invalid document");
 	}
 
-	const auto [it, _is_inserted] = documents_.emplace(document_id, DocumentParams{ ComputeAverageRating(ratings), status , string{document} });
+	InstallMerge(false);
+
+	const DocumentOrdinal ordinal = static_cast<DocumentOrdinal>(document_ids_.size());
+	generation_.Advance();
+	document_ordinals_.emplace(document_id, ordinal);
+	idf_table_.SetDocumentCount(document_ordinals_.size());
+	document_ids_.push_back(document_id);
+	document_ratings_.push_back(ComputeAverageRating(ratings));
+	document_statuses_.push_back(status);
+	removed_documents_.push_back(false);
+	status_documents_[static_cast<size_t>(status)].Add(ordinal);
 	docs_ids_.insert(document_id);
-	const vector<string_view> document_words = SplitIntoWordsNoStop(it->second.text);
-	const double document_size = document_words.size();
-	for (const string_view word : document_words)
+	document_sizes_.push_back(static_cast<uint32_t>(document_words.size()));
+
+	vector<TermId> document_terms(document_words.size());
+	transform(document_words.begin(), document_words.end(), document_terms.begin(),
+		[this](string_view word) { return terms_.Intern(word); });
+	write_postings_.resize(terms_.GetTermCount());
+	idf_table_.SetTermCount(terms_.GetTermCount());
+
+	const vector<TermCount>& term_counts = document_term_counts_.emplace_back(ComputeTermCounts(document_terms));
+	for (const auto [term_id, count] : term_counts)
+	{
+		AppendPosting(term_id, { ordinal, count });
+	}
+	FlushIfFull();
+}
+
+vector<SearchServer::TermCount> SearchServer::ComputeTermCounts(vector<TermId>& document_terms)
+{
+	sort(document_terms.begin(), document_terms.end());
+
+	vector<TermCount> term_counts;
+	for (auto it = document_terms.begin(); it != document_terms.end();)
 	{
-		word_to_documents_freqs_[word][document_id] += 1. / document_size;
-		document_to_words_freqs_[document_id][word] += 1. / document_size;
+		TermCount term_count{ *it, 0 };
+		for (; it != document_terms.end() && *it == term_count.term_id; ++it)
+		{
+			++term_count.count;
+		}
+		term_counts.push_back(term_count);
 	}
+	return term_counts;
+}
+
+void SearchServer::AddDocuments(const vector<RawDocument>& documents)
+{
+	AddDocuments(execution::par, documents);
+}
+
+void SearchServer::AddDocuments(const execution::sequenced_policy& seq, const vector<RawDocument>& documents)
+{
+	AddDocumentsImpl(seq, documents);
+}
+
+void SearchServer::AddDocuments(const execution::parallel_policy& par, const vector<RawDocument>& documents)
+{
+	AddDocumentsImpl(par, documents);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::AddDocumentsImpl(ExecutionPolicy&& policy, const vector<RawDocument>& documents)
+{
+	unordered_set<int> batch_ids;
+	for (const RawDocument& document : documents)
+	{
+		if (document.id < 0 || document_ordinals_.count(document.id) > 0 || !batch_ids.insert(document.id).second)
+		{
+			throw invalid_argument("invalid document");
+		}
+	}
+	const size_t document_count = documents.size();
+	vector<size_t> document_indexes(document_count);
+	iota(document_indexes.begin(), document_indexes.end(), 0);
+
+	// Tokenizing and looking up known words only reads the dictionary, so it runs in parallel.
+	// Control characters are found in the same pass, before anything is changed
+	vector<vector<string_view>> documents_words(document_count);
+	vector<vector<TermId>> documents_terms(document_count);
+	vector<char> is_valid(document_count);
+	for_each(policy, document_indexes.begin(), document_indexes.end(),
+		[&](size_t index)
+		{
+			is_valid[index] = SplitIntoWordsNoStop(documents[index].text, documents_words[index]);
+			documents_terms[index].resize(documents_words[index].size());
+			transform(documents_words[index].begin(), documents_words[index].end(), documents_terms[index].begin(),
+				[this](string_view word) { return terms_.Find(word); });
+		});
+	if (find(is_valid.begin(), is_valid.end(), false) != is_valid.end())
+	{
+		throw invalid_argument("invalid document");
+	}
+	InstallMerge(false);
+	generation_.Advance();
+
+	// Interning new words in document order gives them the same ids sequential AddDocument would
+	for (size_t index = 0; index < document_count; ++index)
+	{
+		for (size_t word_index = 0; word_index < documents_terms[index].size(); ++word_index)
+		{
+			if (documents_terms[index][word_index] == TermDictionary::NO_TERM)
+			{
+				documents_terms[index][word_index] = terms_.Intern(documents_words[index][word_index]);
+			}
+		}
+	}
+	write_postings_.resize(terms_.GetTermCount());
+	idf_table_.SetTermCount(terms_.GetTermCount());
+
+	const DocumentOrdinal first_ordinal = static_cast<DocumentOrdinal>(document_ids_.size());
+	document_sizes_.resize(first_ordinal + document_count);
+	document_term_counts_.resize(first_ordinal + document_count);
+	document_ratings_.resize(first_ordinal + document_count);
+	for_each(policy, document_indexes.begin(), document_indexes.end(),
+		[&](size_t index)
+		{
+			document_sizes_[first_ordinal + index] = static_cast<uint32_t>(documents_terms[index].size());
+			document_term_counts_[first_ordinal + index] = ComputeTermCounts(documents_terms[index]);
+			document_ratings_[first_ordinal + index] = ComputeAverageRating(documents[index].ratings);
+		});
+	for (const RawDocument& document : documents)
+	{
+		const DocumentOrdinal ordinal = static_cast<DocumentOrdinal>(document_ids_.size());
+		document_ordinals_.emplace(document.id, ordinal);
+		document_ids_.push_back(document.id);
+		document_statuses_.push_back(document.status);
+		removed_documents_.push_back(false);
+		status_documents_[static_cast<size_t>(document.status)].Add(ordinal);
+		docs_ids_.insert(document.id);
+	}
+	idf_table_.SetDocumentCount(document_ordinals_.size());
+
+	// Every chunk of documents builds a partial index sorted by term...
+	struct PartialPosting
+	{
+		TermId term_id;
+		Posting posting;
+	};
+
+	bool constexpr is_parallel = IsParallelPolicy<ExecutionPolicy>::value;
+	const size_t chunk_count = is_parallel ? min<size_t>(max(1u, thread::hardware_concurrency()) * 4, max<size_t>(document_count, 1)) : 1;
+	const size_t chunk_size = (document_count + chunk_count - 1) / chunk_count;
+	vector<vector<PartialPosting>> partial_indexes(chunk_count);
+	vector<size_t> chunk_indexes(chunk_count);
+	iota(chunk_indexes.begin(), chunk_indexes.end(), 0);
+
+	for_each(policy, chunk_indexes.begin(), chunk_indexes.end(),
+		[&](size_t chunk_index)
+		{
+			vector<PartialPosting>& partial_index = partial_indexes[chunk_index];
+			const DocumentOrdinal chunk_first = static_cast<DocumentOrdinal>(first_ordinal + min(chunk_index * chunk_size, document_count));
+			const DocumentOrdinal chunk_last = static_cast<DocumentOrdinal>(first_ordinal + min((chunk_index + 1) * chunk_size, document_count));
+			for (DocumentOrdinal ordinal = chunk_first; ordinal < chunk_last; ++ordinal)
+			{
+				for (const auto [term_id, count] : document_term_counts_[ordinal])
+				{
+					partial_index.push_back({ term_id, { ordinal, count } });
+				}
+			}
+			stable_sort(partial_index.begin(), partial_index.end(),
+				[](const PartialPosting& lhs, const PartialPosting& rhs) { return lhs.term_id < rhs.term_id; });
+		});
+
+	// ...then disjoint term ranges are merged into the write segment in parallel, chunks in ordinal order
+	const size_t term_count = write_postings_.size();
+	const size_t term_range_size = (term_count + chunk_count - 1) / chunk_count;
+	vector<vector<TermId>> range_new_terms(chunk_count);
+	for_each(policy, chunk_indexes.begin(), chunk_indexes.end(),
+		[&](size_t range_index)
+		{
+			const TermId range_first = static_cast<TermId>(min(range_index * term_range_size, term_count));
+			const TermId range_last = static_cast<TermId>(min((range_index + 1) * term_range_size, term_count));
+			for (const vector<PartialPosting>& partial_index : partial_indexes)
+			{
+				auto it = lower_bound(partial_index.begin(), partial_index.end(), range_first,
+					[](const PartialPosting& partial_posting, TermId term_id) { return partial_posting.term_id < term_id; });
+				while (it != partial_index.end() && it->term_id < range_last)
+				{
+					const TermId term_id = it->term_id;
+					PostingList& postings = write_postings_[term_id];
+					if (postings.empty())
+					{
+						range_new_terms[range_index].push_back(term_id);
+					}
+					const size_t list_size = postings.size();
+					for (; it != partial_index.end() && it->term_id == term_id; ++it)
+					{
+						postings.push_back(it->posting);
+					}
+					idf_table_.AddDocuments(term_id, static_cast<uint32_t>(postings.size() - list_size));
+				}
+			}
+		});
+	for (const vector<TermId>& new_terms : range_new_terms)
+	{
+		write_terms_.insert(write_terms_.end(), new_terms.begin(), new_terms.end());
+	}
+	FlushIfFull();
+}
+
+vector<char> SearchServer::GetRemovedFlags(DocumentOrdinal first, DocumentOrdinal last) const
+{
+	return vector<char>(removed_documents_.begin() + first, removed_documents_.begin() + last);
+}
+
+void SearchServer::FlushIfFull()
+{
+	if (document_ids_.size() - write_first_ordinal_ >= SEGMENT_FLUSH_DOCUMENT_COUNT)
+	{
+		Flush();
+	}
+}
+
+void SearchServer::Flush()
+{
+	const DocumentOrdinal ordinal_count = static_cast<DocumentOrdinal>(document_ids_.size());
+	if (write_first_ordinal_ == ordinal_count)
+	{
+		return;
+	}
+	sort(write_terms_.begin(), write_terms_.end());
+	segments_.push_back(IndexSegment::Build(write_first_ordinal_, ordinal_count, write_postings_, write_terms_,
+		GetRemovedFlags(write_first_ordinal_, ordinal_count),
+		vector<uint32_t>(document_sizes_.begin() + write_first_ordinal_, document_sizes_.end())));
+	write_terms_.clear();
+	write_first_ordinal_ = ordinal_count;
+	ScheduleMerge();
+}
+
+void SearchServer::ScheduleMerge()
+{
+	if (pending_merge_.result.valid() || segments_.empty())
+	{
+		return;
+	}
+
+	// A tier holds segments that are within SEGMENT_MERGE_FACTOR times of each other in size
+	auto get_tier = [](const IndexSegment& segment)
+	{
+		size_t tier = 0;
+		for (size_t size = segment.GetLastOrdinal() - segment.GetFirstOrdinal(); size >= SEGMENT_FLUSH_DOCUMENT_COUNT * SEGMENT_MERGE_FACTOR; size /= SEGMENT_MERGE_FACTOR)
+		{
+			++tier;
+		}
+		return tier;
+	};
+
+	const size_t tail_tier = get_tier(*segments_.back());
+	size_t run_begin = segments_.size() - 1;
+	while (run_begin > 0 && get_tier(*segments_[run_begin - 1]) == tail_tier)
+	{
+		--run_begin;
+	}
+	if (segments_.size() - run_begin < SEGMENT_MERGE_FACTOR)
+	{
+		return;
+	}
+
+	// Documents removed by now are purged by the merge, later removals stay tombstones
+	pending_merge_.segments.assign(segments_.begin() + run_begin, segments_.end());
+	pending_merge_.result = async(launch::async,
+		[segments = pending_merge_.segments,
+		is_removed = GetRemovedFlags(segments_[run_begin]->GetFirstOrdinal(), segments_.back()->GetLastOrdinal())]()
+		{
+			return IndexSegment::Merge(segments, is_removed);
+		});
+}
+
+void SearchServer::InstallMerge(bool wait)
+{
+	if (!pending_merge_.result.valid() ||
+		(!wait && pending_merge_.result.wait_for(chrono::seconds(0)) != future_status::ready))
+	{
+		return;
+	}
+	shared_ptr<const IndexSegment> merged = pending_merge_.result.get();
+	vector<shared_ptr<const IndexSegment>> merged_segments = move(pending_merge_.segments);
+	pending_merge_.segments.clear();
+
+	// The merge is dropped if one of its segments was replaced in the meantime
+	const auto run_begin = find(segments_.begin(), segments_.end(), merged_segments.front());
+	if (run_begin != segments_.end() && static_cast<size_t>(segments_.end() - run_begin) >= merged_segments.size() &&
+		equal(merged_segments.begin(), merged_segments.end(), run_begin))
+	{
+		*run_begin = move(merged);
+		segments_.erase(run_begin + 1, run_begin + merged_segments.size());
+	}
+	ScheduleMerge();
+}
+
+void SearchServer::WaitForMerges()
+{
+	while (pending_merge_.result.valid())
+	{
+		InstallMerge(true);
+	}
+}
+
+size_t SearchServer::GetSegmentCount() const
+{
+	return segments_.size() + (write_first_ordinal_ < document_ids_.size() ? 1 : 0);
+}
+
+void SearchServer::SetQueryCacheCapacity(size_t capacity)
+{
+	query_cache_ = capacity > 0 ? make_unique<QueryCache>(capacity) : nullptr;
+}
+
+QueryCacheStats SearchServer::GetQueryCacheStats() const
+{
+	return query_cache_ ? query_cache_->GetStats() : QueryCacheStats{};
 }
 
 void SearchServer::RemoveDocument(int document_id)
@@ -165,14 +759,19 @@ void SearchServer::RemoveDocument(const execution::sequenced_policy&, int docume
 	{
 		return;
 	}
-	documents_.erase(document_id);
+	const DocumentOrdinal ordinal = GetOrdinal(document_id);
+	removed_documents_[ordinal] = true;
+	status_documents_[static_cast<size_t>(document_statuses_[ordinal])].Remove(ordinal);
+	generation_.Advance();
 
-	for (auto& [word, freq] : document_to_words_freqs_[document_id])
+	for (const auto [term_id, count] : document_term_counts_[ordinal])
 	{
-		word_to_documents_freqs_[word].erase(document_id);
+		idf_table_.RemoveDocument(term_id);
 	}
 
-	document_to_words_freqs_.erase(document_id);
+	vector<TermCount>().swap(document_term_counts_[ordinal]);
+	document_ordinals_.erase(document_id);
+	idf_table_.SetDocumentCount(document_ordinals_.size());
 }
 
 void SearchServer::RemoveDocument(const execution::parallel_policy&, int document_id)
@@ -181,21 +780,131 @@ void SearchServer::RemoveDocument(const execution::parallel_policy&, int documen
 	{
 		return;
 	}
-	documents_.erase(document_id);
+	const DocumentOrdinal ordinal = GetOrdinal(document_id);
+	removed_documents_[ordinal] = true;
+	status_documents_[static_cast<size_t>(document_statuses_[ordinal])].Remove(ordinal);
+	generation_.Advance();
 
-	const map<string_view, double>& words_freqs = document_to_words_freqs_[document_id];
-	vector<string_view> words_to_remove(words_freqs.size());
+	// Terms of a document are distinct, so every thread decrements its own counters
+	const vector<TermCount>& term_counts = document_term_counts_[ordinal];
+	for_each(execution::par, term_counts.begin(), term_counts.end(),
+		[this](const TermCount& term_count)
+		{
+			idf_table_.RemoveDocument(term_count.term_id);
+		});
 
-	transform(words_freqs.begin(), words_freqs.end(), words_to_remove.begin(),
-		[](const auto& word_and_freq) { return word_and_freq.first; });
+	vector<TermCount>().swap(document_term_counts_[ordinal]);
+	document_ordinals_.erase(document_id);
+	idf_table_.SetDocumentCount(document_ordinals_.size());
+}
 
-	for_each(execution::par, words_to_remove.begin(), words_to_remove.end(),
-		[this, document_id](string_view word)
+void SearchServer::RemoveDocuments(const vector<int>& document_ids)
+{
+	bool is_changed = false;
+	for (const int document_id : document_ids)
+	{
+		if (!docs_ids_.erase(document_id))
 		{
-			word_to_documents_freqs_[word].erase(document_id);
+			continue;
+		}
+		const DocumentOrdinal ordinal = GetOrdinal(document_id);
+		removed_documents_[ordinal] = true;
+		status_documents_[static_cast<size_t>(document_statuses_[ordinal])].Remove(ordinal);
+		for (const auto [term_id, count] : document_term_counts_[ordinal])
+		{
+			idf_table_.RemoveDocument(term_id);
+		}
+		vector<TermCount>().swap(document_term_counts_[ordinal]);
+		document_ordinals_.erase(document_id);
+		is_changed = true;
+	}
+	if (is_changed)
+	{
+		generation_.Advance();
+		idf_table_.SetDocumentCount(document_ordinals_.size());
+	}
+}
+
+void SearchServer::Compact()
+{
+	WaitForMerges();
+	// Cache keys hold term ids, which are renumbered
+	generation_.Advance();
+
+	// Surviving terms are interned in their old order, so term ids keep their relative order
+	vector<TermId> term_remap(terms_.GetTermCount(), TermDictionary::NO_TERM);
+	TermDictionary terms;
+	for (TermId term_id = 0; term_id < term_remap.size(); ++term_id)
+	{
+		if (idf_table_.GetDocumentFreq(term_id) > 0)
+		{
+			term_remap[term_id] = terms.Intern(terms_.GetTerm(term_id));
+		}
+	}
+	idf_table_.Remap(term_remap, terms.GetTermCount());
+
+	for_each(execution::par, segments_.begin(), segments_.end(),
+		[this, &term_remap](shared_ptr<const IndexSegment>& segment)
+		{
+			segment = segment->Compact(GetRemovedFlags(segment->GetFirstOrdinal(), segment->GetLastOrdinal()), term_remap);
 		});
 
-	document_to_words_freqs_.erase(document_id);
+	vector<PostingList> write_postings(terms.GetTermCount());
+	vector<TermId> write_terms;
+	for (const TermId term_id : write_terms_)
+	{
+		if (term_remap[term_id] == TermDictionary::NO_TERM)
+		{
+			continue;
+		}
+		PostingList& postings = write_postings[term_remap[term_id]];
+		copy_if(write_postings_[term_id].begin(), write_postings_[term_id].end(), back_inserter(postings),
+			[this](const Posting& posting) { return !removed_documents_[posting.ordinal]; });
+		if (!postings.empty())
+		{
+			write_terms.push_back(term_remap[term_id]);
+		}
+	}
+
+	for (vector<TermCount>& term_counts : document_term_counts_)
+	{
+		for (TermCount& term_count : term_counts)
+		{
+			term_count.term_id = term_remap[term_count.term_id];
+		}
+	}
+
+	terms_ = move(terms);
+	write_postings_ = move(write_postings);
+	write_terms_ = move(write_terms);
+}
+
+SearchServer::QueryStatistics SearchServer::GetQueryStatistics(string_view query) const
+{
+	QueryStatistics statistics;
+	statistics.document_count = document_ordinals_.size();
+	for (string_view word : SplitQuery(query))
+	{
+		const QueryWord query_word = ParseQueryWord(word);
+		if (!query_word.is_minus)
+		{
+			statistics.plus_words.push_back(query_word.word);
+		}
+	}
+	sort(statistics.plus_words.begin(), statistics.plus_words.end());
+	statistics.plus_words.erase(unique(statistics.plus_words.begin(), statistics.plus_words.end()), statistics.plus_words.end());
+	statistics.document_freqs.reserve(statistics.plus_words.size());
+	for (const string_view word : statistics.plus_words)
+	{
+		const TermId term_id = terms_.Find(word);
+		statistics.document_freqs.push_back(term_id == TermDictionary::NO_TERM ? 0 : idf_table_.GetDocumentFreq(term_id));
+	}
+	return statistics;
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view query, DocumentStatus status, const QueryStatistics& statistics) const
+{
+	return FindTopDocuments(query, StatusFilter{ status }, statistics);
 }
 
 vector<Document> SearchServer::FindTopDocuments(string_view query) const
@@ -205,10 +914,55 @@ vector<Document> SearchServer::FindTopDocuments(string_view query) const
 
 vector<Document> SearchServer::FindTopDocuments(string_view query, DocumentStatus status) const
 {
-	return FindTopDocuments(execution::seq, query, [status](int document_id, DocumentStatus document_status, int rating) { return document_status == status; });
+	return FindTopDocuments(execution::seq, query, status);
+}
+
+void SearchServer::FindTopDocuments(string_view query, DocumentStatus status, vector<Document>& result) const
+{
+	const ScratchLease lease;
+	Query& query_terms = lease.Get().query;
+	ParseQuery(query, query_terms);
+	FindTopDocumentsImpl(execution::seq, query_terms, StatusFilter{ status }, type_index(typeid(DocumentStatus)), status, result);
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_view raw_query, int document_id) const
 {
 	return MatchDocument(execution::seq, raw_query, document_id);
 }
+
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query) const
+{
+	return FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL);
+}
+
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status) const
+{
+	return FindTopDocuments(execution::seq, query, status);
+}
+
+void SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status, vector<Document>& result) const
+{
+	FindTopDocumentsImpl(execution::seq, *GetPreparedTerms(query), StatusFilter{ status }, type_index(typeid(DocumentStatus)), status, result);
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const PreparedQuery& query, int document_id) const
+{
+	return MatchDocument(execution::seq, query, document_id);
+}
+
+DocumentMatches SearchServer::MatchDocuments(string_view raw_query, const vector<int>& document_ids) const
+{
+	return MatchDocuments(execution::seq, raw_query, document_ids);
+}
+
+DocumentMatches SearchServer::MatchDocuments(const PreparedQuery& query, const vector<int>& document_ids) const
+{
+	return MatchDocuments(execution::seq, query, document_ids);
+}
+
+bool SearchServer::HasTerm(const vector<TermCount>& term_counts, TermId term_id)
+{
+	const auto it = lower_bound(term_counts.begin(), term_counts.end(), term_id,
+		[](const TermCount& term_count, TermId term_id) { return term_count.term_id < term_id; });
+	return it != term_counts.end() && it->term_id == term_id;
+}
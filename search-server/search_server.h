@@ -2,50 +2,287 @@
 
 #include "document.h"
 #include "log_duration.h"
-#include "concurrent_map.h"
+#include "term_dictionary.h"
+#include "index_segment.h"
+#include "document_bitmap.h"
+#include "document_filter.h"
+#include "paginator.h"
+#include "query_cache.h"
+#include "idf_table.h"
 
+#include <array>
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <set>
 #include <tuple>
 #include <execution>
+#include <future>
+#include <memory>
 #include <stdexcept>
 #include <algorithm>
 #include <type_traits>
+#include <thread>
+#include <numeric>
+#include <optional>
+#include <typeindex>
+#include <functional>
 
 const size_t MAX_RESULT_DOCUMENT_COUNT = 5;
 
-class SearchServer
+const double RELEVANCE_EPSILON = 1e-6;
+
+const size_t DOCUMENT_STATUS_COUNT = 4;
+
+// Documents collected in the write segment before it is flushed into an immutable segment
+const size_t SEGMENT_FLUSH_DOCUMENT_COUNT = 4096;
+
+// Number of segments of the same size tier that are merged into one in the background
+const size_t SEGMENT_MERGE_FACTOR = 8;
+
+// Whether an execution policy argument asks for the parallel version of an algorithm.
+// Policies come in as forwarding references, so their type is decayed before comparing
+template <typename ExecutionPolicy>
+struct IsParallelPolicy : std::is_same<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy>
 {
-private:
-	struct DocumentParams
+};
+
+// Result of matching one query against many documents. The matched words of the i-th document are
+// GetWords(i), sorted; a document containing a minus-word has none. All words share one array
+struct DocumentMatches
+{
+	std::vector<std::string_view> words;
+	// offsets[i] is where the words of the i-th document begin, the last one is words.size()
+	std::vector<size_t> offsets{ 0 };
+	std::vector<DocumentStatus> statuses;
+
+	size_t GetDocumentCount() const
 	{
-		int rating;
-		DocumentStatus status;
-		std::string text;
-	};
+		return statuses.size();
+	}
 
+	IteratorRange<const std::string_view*> GetWords(size_t index) const
+	{
+		return IteratorRange<const std::string_view*>(words.data() + offsets[index], words.data() + offsets[index + 1]);
+	}
+};
+
+class SearchServer
+{
+private:
 	struct QueryWord
 	{
 		std::string_view word;
 		bool is_minus;
 	};
 
+	// Query words resolved to term ids, words absent from the dictionary are dropped
 	struct Query
 	{
+		std::vector<TermId> plus_terms;
+		std::vector<TermId> minus_terms;
+		// IDF of every plus term, filled only for queries with unique terms
+		std::vector<double> plus_idfs;
+	};
+
+public:
+	// Query validated and resolved once by PrepareQuery. When it runs on another server or after
+	// the documents have changed, it is resolved again from its words without parsing, once per
+	// server state: the terms are kept for the next runs. May be run from several threads at once
+	class PreparedQuery
+	{
+	public:
+		PreparedQuery() = default;
+
+		PreparedQuery(const PreparedQuery& other);
+		PreparedQuery& operator=(const PreparedQuery& other);
+
+		PreparedQuery(PreparedQuery&& other) = default;
+		PreparedQuery& operator=(PreparedQuery&& other) = default;
+
+	private:
+		friend class SearchServer;
+
+		struct ResolvedQuery
+		{
+			Query query;
+			uint64_t generation;
+		};
+
+		std::vector<std::string> plus_words_;
+		std::vector<std::string> minus_words_;
+		// Terms of the last server state the query ran on. Never changed in place, only replaced
+		// with std::atomic_store, so that concurrent runs read either the old or the new terms
+		mutable std::shared_ptr<const ResolvedQuery> resolved_;
+	};
+
+	// Counts behind the IDFs of a query: the number of documents and, for every distinct plus word,
+	// the number of documents containing it. Servers holding disjoint parts of one corpus add up
+	// theirs, so that searching each of them with the sum ranks as one server holding the whole corpus
+	struct QueryStatistics
+	{
+		size_t document_count = 0;
+		// Sorted, views into the query
 		std::vector<std::string_view> plus_words;
-		std::vector<std::string_view> minus_words;
+		std::vector<uint32_t> document_freqs;
+	};
+
+private:
+
+	// Filter of the status overloads of FindTopDocuments, answered by the status bitmaps
+	struct StatusFilter
+	{
+		DocumentStatus status;
+
+		bool operator()(int, DocumentStatus document_status, int) const
+		{
+			return document_status == status;
+		}
 	};
 
-	std::map<std::string_view, std::map<int, double>> word_to_documents_freqs_;
-	std::map<int, std::map<std::string_view, double>> document_to_words_freqs_;
+	struct TermCount
+	{
+		TermId term_id;
+		uint32_t count;
+	};
+
+	// Keeps the scored documents that may still end up among the top_count most relevant ones.
+	// A document tying with the top_count-th best (closer than RELEVANCE_EPSILON) may be ranked
+	// above it by rating, so the threshold lies that far below it, and as far again to absorb
+	// rounding of score bounds
+	class TopDocumentCollector
+	{
+	public:
+		// Works in the storage of top_relevances and candidates, which it clears
+		TopDocumentCollector(size_t top_count, std::vector<double>& top_relevances, std::vector<Document>& candidates);
+
+		// Relevance below which a document cannot enter the top
+		double GetThreshold() const;
+
+		void Add(const Document& document);
+
+		// Appends the candidates to documents
+		void Finish(std::vector<Document>& documents);
+
+	private:
+		size_t top_count_;
+		// Min-heap of the best relevances so far
+		std::vector<double>& top_relevances_;
+		std::vector<Document>& candidates_;
+		double threshold_;
+
+		void DropBelowThreshold();
+	};
+
+	// Buffers of scoring one ordinal range, kept between searches so that they stop allocating once grown
+	struct SearchScratch
+	{
+		Query query;
+		std::vector<TermId> plus_terms;
+		std::vector<double> idfs;
+		std::vector<TermPostings> term_postings;
+		std::vector<size_t> positions;
+		std::vector<PostingCursor> cursors;
+		std::vector<double> list_idfs;
+		std::vector<double> score_bounds;
+		std::vector<double> bound_sums;
+		std::vector<double> scores;
+		std::vector<double> top_relevances;
+		std::vector<Document> candidates;
+	};
+
+	// Lends a SearchScratch of the current thread for the lifetime of the lease. Leases taken while
+	// another is alive get scratches of their own, so a documents filter may search as well
+	class ScratchLease
+	{
+	public:
+		ScratchLease();
+
+		ScratchLease(const ScratchLease&) = delete;
+		ScratchLease& operator=(const ScratchLease&) = delete;
+
+		~ScratchLease();
+
+		SearchScratch& Get() const;
+
+	private:
+		struct ScratchPool
+		{
+			std::vector<std::unique_ptr<SearchScratch>> scratches;
+			size_t lease_count = 0;
+		};
+
+		SearchScratch* scratch_;
+
+		static ScratchPool& GetPool();
+	};
+
+	// Version of the index drawn from a process-wide counter, so that no two states of any servers
+	// share one, even after a server is replaced by assignment or LoadSnapshot. A moved-from server
+	// gets a new one, it no longer holds the index the old one stood for
+	class Generation
+	{
+	public:
+		Generation();
+
+		Generation(const Generation& other) = default;
+		Generation& operator=(const Generation& other) = default;
+
+		Generation(Generation&& other) noexcept;
+		Generation& operator=(Generation&& other) noexcept;
+
+		void Advance();
+
+		uint64_t Get() const;
+
+	private:
+		uint64_t value_;
+
+		static uint64_t Next();
+	};
+
+	struct PendingMerge
+	{
+		std::vector<std::shared_ptr<const IndexSegment>> segments;
+		std::future<std::shared_ptr<const IndexSegment>> result;
+	};
+
+	TermDictionary terms_;
+	IdfTable idf_table_;
 	std::set<std::string, std::less<>> stop_words_;
 
-	std::map<int, DocumentParams> documents_;
+	// Immutable segments ordered by ordinal, together they cover all ordinals below write_first_ordinal_
+	std::vector<std::shared_ptr<const IndexSegment>> segments_;
+	// Postings of the documents added since the last flush, indexed by TermId
+	std::vector<PostingList> write_postings_;
+	// Terms having postings in write_postings_
+	std::vector<TermId> write_terms_;
+	DocumentOrdinal write_first_ordinal_ = 0;
+	PendingMerge pending_merge_;
+
+	std::unordered_map<int, DocumentOrdinal> document_ordinals_;
+	// Document columns indexed by DocumentOrdinal
+	std::vector<int> document_ids_;
+	std::vector<int> document_ratings_;
+	std::vector<DocumentStatus> document_statuses_;
+	// Tombstones: postings of removed documents stay in the index until a merge or Compact drops them
+	std::vector<char> removed_documents_;
+	// Ordinals of the live documents of every status, indexed by DocumentStatus
+	std::array<DocumentBitmap, DOCUMENT_STATUS_COUNT> status_documents_;
+	// Numbers of words of the documents, term frequencies are term counts divided by them
+	std::vector<uint32_t> document_sizes_;
+	// Terms of every document, kept sorted by term_id
+	std::vector<std::vector<TermCount>> document_term_counts_;
 	std::set<int> docs_ids_;
 
+	size_t max_result_document_count_ = MAX_RESULT_DOCUMENT_COUNT;
+
+	// Changes whenever the set of documents changes, cached results of older generations are stale
+	Generation generation_;
+	std::unique_ptr<QueryCache> query_cache_;
+
 	static int ComputeAverageRating(const std::vector<int>& ratings);
 
 	static bool IsValidWord(std::string_view word);
@@ -54,7 +291,16 @@ private:
 
 	bool IsStopWord(std::string_view word) const;
 
-	std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
+	// Replaces the contents of words with the words of text that are not stop words.
+	// Returns false if text contains a control character
+	bool SplitIntoWordsNoStop(std::string_view text, std::vector<std::string_view>& words) const;
+
+	// Words of a query in a per-thread buffer, valid until the next call on the same thread.
+	// Throws std::invalid_argument if the query contains a control character
+	const std::vector<std::string_view>& SplitQuery(std::string_view query) const;
+
+	// Per-thread buffer of words, so that parsing does not allocate once it has grown
+	static std::vector<std::string_view>& GetWordBuffer();
 
 	template <typename StringCollection>
 	void SetStopWords(const StringCollection& stop_words);
@@ -63,12 +309,91 @@ private:
 
 	Query ParseQuery(std::string_view query, bool do_unique = true) const;
 
-	double ComputeWordIDF(std::string_view word) const;
+	// Same as ParseQuery, but replaces the contents of query_terms, keeping their storage
+	void ParseQuery(std::string_view query, Query& query_terms, bool do_unique = true) const;
+
+	// Sorts and deduplicates the terms and looks up their IDF
+	void NormalizeQuery(Query& query_terms) const;
 
+	Query ResolveQuery(const PreparedQuery& prepared_query) const;
+
+	// Replaces the IDFs of the plus terms with the ones of statistics gathered for the same query
+	void ApplyQueryStatistics(const QueryStatistics& statistics, Query& query_terms) const;
+
+	// Returns the terms of prepared_query for the current state, resolving them again if they are stale
+	std::shared_ptr<const Query> GetPreparedTerms(const PreparedQuery& prepared_query) const;
+
+	// Calls visitor with the ordinal and the term count of every posting of the term, in ordinal order
+	template <typename Visitor>
+	void ForEachPosting(TermId term_id, Visitor visitor) const;
+
+	size_t FindSegmentIndex(DocumentOrdinal ordinal) const;
+
+	bool HasPosting(TermId term_id, DocumentOrdinal ordinal) const;
+
+	void AppendPosting(TermId term_id, const Posting& posting);
+
+	// Removal flags of the ordinals in [first, last), in the form IndexSegment factories take
+	std::vector<char> GetRemovedFlags(DocumentOrdinal first, DocumentOrdinal last) const;
+
+	void FlushIfFull();
+
+	// Starts a background merge once SEGMENT_MERGE_FACTOR segments of the same tier pile up at the tail
+	void ScheduleMerge();
+
+	// Replaces the merged segments with the result of the pending merge if it is ready or wait is set
+	void InstallMerge(bool wait);
+
+	// Sorts the document terms and folds repeated ones into counts
+	static std::vector<TermCount> ComputeTermCounts(std::vector<TermId>& document_terms);
+
+	template <typename ExecutionPolicy>
+	void AddDocumentsImpl(ExecutionPolicy&& policy, const std::vector<RawDocument>& documents);
+
+	DocumentOrdinal GetOrdinal(int document_id) const;
+
+	// Unlike segment lists, the lists of the write segment have no blocks
+	TermPostings GetWriteTermPostings(TermId term_id) const;
+
+	// Document-at-a-time MaxScore over the lists of one segment, restricted to ordinals in [first, last).
+	// Lists are ordered by the bound of their score. Documents that occur only in the lists whose
+	// bounds add up to less than the threshold cannot enter the top, so these lists are never walked,
+	// only probed for documents found in the others, and block bounds cut the probing short
+	template <typename DocumentAcceptor>
+	void ScoreSegment(const std::vector<TermPostings>& term_postings, const std::vector<double>& idfs,
+		DocumentOrdinal first, DocumentOrdinal last, DocumentAcceptor is_accepted, TopDocumentCollector& collector, SearchScratch& scratch) const;
+
+	// Appends to candidates only the documents that may be among the top_count most relevant
+	template <typename DocumentsFilter, typename ExecutionPolicy>
+	void FindTopCandidates(ExecutionPolicy&& policy, const Query& query_terms, DocumentsFilter documents_filter, size_t top_count,
+		std::vector<Document>& candidates) const;
+
+	// Replaces the contents of result with the top documents.
+	// Goes through the query cache if it is on and filter_type is set; filter_type and status identify documents_filter
 	template <typename DocumentsFilter, typename ExecutionPolicy>
-	std::vector<Document> FindAllDocuments(ExecutionPolicy&& policy, std::string_view query, DocumentsFilter documents_filter) const;
+	void FindTopDocumentsImpl(ExecutionPolicy&& policy, const Query& query_terms, DocumentsFilter documents_filter,
+		std::optional<std::type_index> filter_type, DocumentStatus status, std::vector<Document>& result) const;
+
+	template <typename DocumentsFilter>
+	static std::optional<std::type_index> GetFilterType();
+
+	template <typename ExecutionPolicy>
+	std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocumentImpl(ExecutionPolicy&& policy, const Query& query_terms, DocumentOrdinal ordinal) const;
+
+	// Looks the query terms up in the forward index of every document
+	template <typename ExecutionPolicy>
+	DocumentMatches MatchDocumentsImpl(ExecutionPolicy&& policy, const Query& query_terms, const std::vector<int>& document_ids) const;
+
+	static bool HasTerm(const std::vector<TermCount>& term_counts, TermId term_id);
+
+	// Leaves only the top_count most relevant documents, ordered by IsMoreRelevant
+	template <typename ExecutionPolicy>
+	static void SelectTopDocuments(ExecutionPolicy&& policy, std::vector<Document>& documents, size_t top_count);
 
 public:
+	// Order of search results
+	static bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
 	SearchServer();
 
 	template <typename StringCollection>
@@ -80,24 +405,71 @@ public:
 
 	int GetDocumentCount() const;
 
+	size_t GetMaxResultDocumentCount() const;
+
+	void SetMaxResultDocumentCount(size_t max_result_document_count);
+
 	std::set<int>::const_iterator begin() const;
 
 	std::set<int>::const_iterator end() const;
 
-	const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+	std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
 
 	void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+	// Same result as calling AddDocument for every document in order, runs in parallel by default.
+	// Throws before changing anything if any of the documents is invalid
+	void AddDocuments(const std::vector<RawDocument>& documents);
+
+	void AddDocuments(const std::execution::sequenced_policy& seq, const std::vector<RawDocument>& documents);
+
+	void AddDocuments(const std::execution::parallel_policy& par, const std::vector<RawDocument>& documents);
+
 	void RemoveDocument(int document_id);
 
 	void RemoveDocument(const std::execution::sequenced_policy& seq, int document_id);
 
 	void RemoveDocument(const std::execution::parallel_policy& par, int document_id);
 
+	// Same as RemoveDocument for every document, missing ones are skipped
+	void RemoveDocuments(const std::vector<int>& document_ids);
+
+	// Calls visitor with every term of the document in increasing order of TermId
+	template <typename Visitor>
+	void ForEachDocumentTerm(int document_id, Visitor visitor) const;
+
+	// Moves the documents of the write segment into a new immutable segment
+	void Flush();
+
+	// Blocks until background merges are finished and their results are in use
+	void WaitForMerges();
+
+	// Drops the postings of all removed documents and the words no document contains any more.
+	// Views returned earlier by MatchDocument and GetWordFrequencies become invalid
+	void Compact();
+
+	size_t GetSegmentCount() const;
+
+	// Keeps the top documents of up to capacity queries filtered by status or by a stateless predicate,
+	// queries differing only in word order or repeated words share an entry. 0 turns the cache off
+	void SetQueryCacheCapacity(size_t capacity);
+
+	QueryCacheStats GetQueryCacheStats() const;
+
+	// Writes the whole index to a versioned, checksummed binary file
+	void SaveSnapshot(const std::string& path) const;
+
+	// Restores a server written by SaveSnapshot, throws std::invalid_argument if the file is damaged
+	static SearchServer LoadSnapshot(const std::string& path);
+
 	std::vector<Document> FindTopDocuments(std::string_view query) const;
 
 	std::vector<Document> FindTopDocuments(std::string_view query, DocumentStatus status) const;
 
+	// Same as FindTopDocuments(query, status), but replaces the contents of result, so that a vector
+	// reused across calls stops allocating once it has grown. Runs sequentially
+	void FindTopDocuments(std::string_view query, DocumentStatus status, std::vector<Document>& result) const;
+
 	template <typename DocumentsFilter>
 	std::vector<Document> FindTopDocuments(std::string_view query, DocumentsFilter documents_filter) const;
 
@@ -110,12 +482,65 @@ public:
 	template <typename DocumentsFilter, typename ExecutionPolicy>
 	std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view query, DocumentsFilter documents_filter) const;
 
+	// Throws std::invalid_argument for the same queries FindTopDocuments rejects
+	QueryStatistics GetQueryStatistics(std::string_view query) const;
+
+	// Ranks with statistics of this query summed over several servers instead of the own counts.
+	// Runs sequentially and bypasses the query cache
+	std::vector<Document> FindTopDocuments(std::string_view query, DocumentStatus status, const QueryStatistics& statistics) const;
+
+	template <typename DocumentsFilter>
+	std::vector<Document> FindTopDocuments(std::string_view query, DocumentsFilter documents_filter, const QueryStatistics& statistics) const;
+
 	std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
 
 	template <typename ExecutionPolicy>
 	std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(ExecutionPolicy&& policy, std::string_view raw_query, int document_id) const;
+
+	// MatchDocument for every document of document_ids with the query parsed once.
+	// Throws std::out_of_range if one of the documents does not exist
+	DocumentMatches MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const;
+
+	template <typename ExecutionPolicy>
+	DocumentMatches MatchDocuments(ExecutionPolicy&& policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
+
+	// Throws std::invalid_argument for the same queries FindTopDocuments rejects
+	PreparedQuery PrepareQuery(std::string_view query) const;
+
+	std::vector<Document> FindTopDocuments(const PreparedQuery& query) const;
+
+	std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentStatus status) const;
+
+	// Same as FindTopDocuments(query, status), but replaces the contents of result. Once the query
+	// terms are resolved for the current state and the buffers have grown, a sequential run on the same
+	// thread allocates nothing more; with the query cache on, the cache lookup still does
+	void FindTopDocuments(const PreparedQuery& query, DocumentStatus status, std::vector<Document>& result) const;
+
+	template <typename DocumentsFilter>
+	std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentsFilter documents_filter) const;
+
+	template <typename ExecutionPolicy>
+	std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query) const;
+
+	template <typename ExecutionPolicy>
+	std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentStatus status) const;
+
+	template <typename DocumentsFilter, typename ExecutionPolicy>
+	std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentsFilter documents_filter) const;
+
+	std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const PreparedQuery& query, int document_id) const;
+
+	template <typename ExecutionPolicy>
+	std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(ExecutionPolicy&& policy, const PreparedQuery& query, int document_id) const;
+
+	DocumentMatches MatchDocuments(const PreparedQuery& query, const std::vector<int>& document_ids) const;
+
+	template <typename ExecutionPolicy>
+	DocumentMatches MatchDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, const std::vector<int>& document_ids) const;
 };
 
+using PreparedQuery = SearchServer::PreparedQuery;
+
 template <typename StringCollection>
 void SearchServer::SetStopWords(const StringCollection& stop_words)
 {
@@ -143,124 +568,520 @@ std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, s
 template<typename ExecutionPolicy>
 inline std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view query, DocumentStatus status) const
 {
-	return FindTopDocuments(policy, query, [status](int document_id, DocumentStatus document_status, int rating) { return document_status == status; });
+	std::vector<Document> result;
+	FindTopDocumentsImpl(policy, ParseQuery(query),
+		StatusFilter{ status },
+		std::type_index(typeid(DocumentStatus)), status, result);
+	return result;
 }
 
 template <typename DocumentsFilter, typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view query, DocumentsFilter documents_filter) const
 {
-	std::vector<Document> result = FindAllDocuments(policy, query, documents_filter);
-	
-	const double epsilon = 1e-6;
-	sort(policy,
-		result.begin(),
-		result.end(),
-		[epsilon](const Document& a, const Document& b)
-		{
-			if (std::abs(a.relevance - b.relevance) < epsilon)
-			{
-				return a.rating > b.rating;
-			}
-			else
-			{
-				return a.relevance > b.relevance;
-			}
-		});
-	if (result.size() > MAX_RESULT_DOCUMENT_COUNT)
-	{
-		result.resize(MAX_RESULT_DOCUMENT_COUNT);
-	}
+	std::vector<Document> result;
+	FindTopDocumentsImpl(policy, ParseQuery(query), documents_filter, GetFilterType<DocumentsFilter>(), DocumentStatus::ACTUAL, result);
+	return result;
+}
 
+template <typename DocumentsFilter>
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view query, DocumentsFilter documents_filter, const QueryStatistics& statistics) const
+{
+	std::vector<Document> result;
+	Query query_terms = ParseQuery(query);
+	ApplyQueryStatistics(statistics, query_terms);
+	FindTopDocumentsImpl(std::execution::seq, query_terms, documents_filter, std::nullopt, DocumentStatus::ACTUAL, result);
+	return result;
+}
+
+template <typename DocumentsFilter>
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentsFilter documents_filter) const
+{
+	return FindTopDocuments(std::execution::seq, query, documents_filter);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query) const
+{
+	return FindTopDocuments(policy, query, DocumentStatus::ACTUAL);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentStatus status) const
+{
+	std::vector<Document> result;
+	FindTopDocumentsImpl(policy, *GetPreparedTerms(query),
+		StatusFilter{ status },
+		std::type_index(typeid(DocumentStatus)), status, result);
 	return result;
 }
 
 template <typename DocumentsFilter, typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindAllDocuments(ExecutionPolicy&& policy, std::string_view query, DocumentsFilter documents_filter) const
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentsFilter documents_filter) const
 {
-	const Query query_words = ParseQuery(query);
+	std::vector<Document> result;
+	FindTopDocumentsImpl(policy, *GetPreparedTerms(query), documents_filter, GetFilterType<DocumentsFilter>(), DocumentStatus::ACTUAL, result);
+	return result;
+}
 
-	std::set<int> documents_with_minus_words;
+template <typename DocumentsFilter>
+std::optional<std::type_index> SearchServer::GetFilterType()
+{
+	// Only a predicate without state is fully identified by its type
+	if constexpr (std::is_empty_v<DocumentsFilter>)
+	{
+		return std::type_index(typeid(DocumentsFilter));
+	}
+	else
+	{
+		return std::nullopt;
+	}
+}
 
-	for (std::string_view minus_word : query_words.minus_words)
+template <typename DocumentsFilter, typename ExecutionPolicy>
+void SearchServer::FindTopDocumentsImpl(ExecutionPolicy&& policy, const Query& query_terms, DocumentsFilter documents_filter,
+	std::optional<std::type_index> filter_type, DocumentStatus status, std::vector<Document>& result) const
+{
+	std::optional<QueryCache::Key> cache_key;
+	if (query_cache_ && filter_type)
 	{
-		for (const auto& [id, tf] : word_to_documents_freqs_.at(minus_word))
+		cache_key = QueryCache::Key{ query_terms.plus_terms, query_terms.minus_terms, *filter_type, status, max_result_document_count_ };
+		if (std::optional<std::vector<Document>> cached = query_cache_->Find(*cache_key, generation_.Get()))
 		{
-			documents_with_minus_words.insert(id);
+			result = std::move(*cached);
+			return;
 		}
 	}
 
-	std::map<int, double> document_to_relevance;
-	
-	bool constexpr is_parallel = std::is_same_v<ExecutionPolicy, const std::execution::parallel_policy&>;
-	ConcurrentMap<int, double> cm_document_to_relevance(50);
+	result.clear();
+	FindTopCandidates(policy, query_terms, documents_filter, max_result_document_count_, result);
+	SelectTopDocuments(policy, result, max_result_document_count_);
+	if (cache_key)
+	{
+		query_cache_->Insert(*cache_key, generation_.Get(), result);
+	}
+}
 
-	std::for_each(
-		policy, query_words.plus_words.begin(), query_words.plus_words.end(),
-		[&](std::string_view word)
+template <typename ExecutionPolicy>
+void SearchServer::SelectTopDocuments(ExecutionPolicy&& policy, std::vector<Document>& documents, size_t top_count)
+{
+	bool constexpr is_parallel = IsParallelPolicy<ExecutionPolicy>::value;
+	const size_t chunk_count = is_parallel ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+
+	if (chunk_count > 1 && documents.size() > chunk_count * top_count)
+	{
+		// Every chunk keeps its own top in front, then the chunk tops are merged
+		const size_t chunk_size = (documents.size() + chunk_count - 1) / chunk_count;
+		std::vector<size_t> chunk_begins;
+		for (size_t chunk_begin = 0; chunk_begin < documents.size(); chunk_begin += chunk_size)
 		{
-			if (word_to_documents_freqs_.count(word) != 0)
+			chunk_begins.push_back(chunk_begin);
+		}
+		std::for_each(policy, chunk_begins.begin(), chunk_begins.end(),
+			[&documents, chunk_size, top_count](size_t chunk_begin)
 			{
-				const double idf = ComputeWordIDF(word);
-				for (const auto& [id, tf] : word_to_documents_freqs_.at(word))
-				{
-					const DocumentParams& document = documents_.at(id);
-					if (documents_with_minus_words.count(id) == 0 && documents_filter(id, document.status, document.rating))
-					{
-						if (is_parallel)
-						{
-							cm_document_to_relevance[id].ref_to_value += tf * idf;
-						}
-						else
-						{
-							document_to_relevance[id] += tf * idf;
-						}
-						
-					}
-				}
-			}
+				const auto first = documents.begin() + chunk_begin;
+				const auto last = documents.begin() + std::min(chunk_begin + chunk_size, documents.size());
+				std::partial_sort(first, first + std::min<size_t>(top_count, last - first), last, IsMoreRelevant);
+			});
+
+		std::vector<Document> candidates;
+		candidates.reserve(chunk_begins.size() * top_count);
+		for (const size_t chunk_begin : chunk_begins)
+		{
+			const size_t chunk_top = std::min(top_count, std::min(chunk_size, documents.size() - chunk_begin));
+			candidates.insert(candidates.end(), documents.begin() + chunk_begin, documents.begin() + chunk_begin + chunk_top);
+		}
+		documents = std::move(candidates);
+	}
+
+	if (documents.size() > top_count)
+	{
+		std::partial_sort(documents.begin(), documents.begin() + top_count, documents.end(), IsMoreRelevant);
+		documents.resize(top_count);
+	}
+	else
+	{
+		std::sort(documents.begin(), documents.end(), IsMoreRelevant);
+	}
+}
+
+template <typename DocumentAcceptor>
+void SearchServer::ScoreSegment(const std::vector<TermPostings>& term_postings, const std::vector<double>& idfs,
+	DocumentOrdinal first, DocumentOrdinal last, DocumentAcceptor is_accepted, TopDocumentCollector& collector, SearchScratch& scratch) const
+{
+	// Lists are walked in ascending order of their score bounds, positions keeps their query term order
+	const size_t list_count = term_postings.size();
+	std::vector<size_t>& positions = scratch.positions;
+	positions.resize(list_count);
+	std::iota(positions.begin(), positions.end(), 0);
+	std::sort(positions.begin(), positions.end(), [&](size_t lhs, size_t rhs)
+		{
+			return term_postings[lhs].max_term_freq * idfs[lhs] < term_postings[rhs].max_term_freq * idfs[rhs];
 		});
-	
-	if (is_parallel)
+	std::vector<PostingCursor>& cursors = scratch.cursors;
+	cursors.clear();
+	std::vector<double>& list_idfs = scratch.list_idfs;
+	list_idfs.resize(list_count);
+	std::vector<double>& score_bounds = scratch.score_bounds;
+	score_bounds.resize(list_count);
+	// bound_sums[k] bounds the score a document gets from the first k lists
+	std::vector<double>& bound_sums = scratch.bound_sums;
+	bound_sums.assign(list_count + 1, 0.);
+	for (size_t k = 0; k < list_count; ++k)
+	{
+		const size_t position = positions[k];
+		cursors.emplace_back(term_postings[position]);
+		cursors.back().Seek(first);
+		list_idfs[k] = idfs[position];
+		score_bounds[k] = term_postings[position].max_term_freq * idfs[position];
+		bound_sums[k + 1] = bound_sums[k] + score_bounds[k];
+	}
+
+	// Lists before essential_begin are the non-essential ones
+	double threshold = collector.GetThreshold();
+	size_t essential_begin = 0;
+	auto update_threshold = [&]()
+	{
+		threshold = collector.GetThreshold();
+		while (essential_begin < list_count && bound_sums[essential_begin + 1] < threshold)
+		{
+			++essential_begin;
+		}
+	};
+	update_threshold();
+
+	std::vector<double>& scores = scratch.scores;
+	scores.assign(list_count, 0.);
+	while (essential_begin < list_count)
+	{
+		DocumentOrdinal candidate = last;
+		for (size_t k = essential_begin; k < list_count; ++k)
+		{
+			if (!cursors[k].IsAtEnd())
+			{
+				candidate = std::min(candidate, cursors[k].GetOrdinal());
+			}
+		}
+		if (candidate >= last)
+		{
+			break;
+		}
+
+		double bound = bound_sums[essential_begin];
+		for (size_t k = essential_begin; k < list_count; ++k)
+		{
+			PostingCursor& cursor = cursors[k];
+			if (!cursor.IsAtEnd() && cursor.GetOrdinal() == candidate)
+			{
+				const double score = cursor.GetTermFreq() * list_idfs[k];
+				scores[positions[k]] = score;
+				bound += score;
+				cursor.Next();
+			}
+		}
+
+		bool is_candidate = bound >= threshold && is_accepted(candidate);
+		for (size_t k = essential_begin; is_candidate && k-- > 0;)
+		{
+			PostingCursor& cursor = cursors[k];
+			bound -= score_bounds[k];
+			if (bound + cursor.GetMaxTermFreq(candidate) * list_idfs[k] < threshold)
+			{
+				is_candidate = false;
+				break;
+			}
+			cursor.Seek(candidate);
+			if (!cursor.IsAtEnd() && cursor.GetOrdinal() == candidate)
+			{
+				const double score = cursor.GetTermFreq() * list_idfs[k];
+				scores[positions[k]] = score;
+				bound += score;
+			}
+			is_candidate = bound >= threshold;
+		}
+
+		if (is_candidate)
+		{
+			// Summed in query term order, so the relevance is the one exhaustive scoring computes
+			double relevance = 0.;
+			for (const double score : scores)
+			{
+				relevance += score;
+			}
+			collector.Add({ document_ids_[candidate], relevance, document_ratings_[candidate] });
+			update_threshold();
+		}
+		std::fill(scores.begin(), scores.end(), 0.);
+	}
+}
+
+template <typename DocumentsFilter, typename ExecutionPolicy>
+void SearchServer::FindTopCandidates(ExecutionPolicy&& policy, const Query& query_terms, DocumentsFilter documents_filter, size_t top_count,
+	std::vector<Document>& candidates) const
+{
+	const DocumentOrdinal ordinal_count = static_cast<DocumentOrdinal>(document_ids_.size());
+	// Every list yields its ordinals in increasing order, which appends them to the bitmap
+	DocumentBitmap documents_with_minus_words;
+	for (const TermId minus_term : query_terms.minus_terms)
+	{
+		DocumentBitmap term_documents;
+		ForEachPosting(minus_term,
+			[&term_documents](DocumentOrdinal ordinal, uint32_t)
+			{
+				term_documents.Add(ordinal);
+			});
+		documents_with_minus_words |= term_documents;
+	}
+
+	// A DocumentFilter of one status takes its candidates from the bitmap of that status
+	const DocumentBitmap* single_status_documents = nullptr;
+	if constexpr (IsDocumentFilter<DocumentsFilter>::value)
 	{
-		document_to_relevance = cm_document_to_relevance.BuildOrdinaryMap();
+		if (const std::optional<DocumentStatus> status = documents_filter.GetSingleStatus();
+			status && static_cast<size_t>(*status) < DOCUMENT_STATUS_COUNT)
+		{
+			single_status_documents = &status_documents_[static_cast<size_t>(*status)];
+		}
 	}
-	std::vector<Document> matched_documents;
 
-	for (auto [document_id, relevance] : document_to_relevance)
+	auto is_accepted = [&](DocumentOrdinal ordinal)
+	{
+		if constexpr (std::is_same_v<DocumentsFilter, StatusFilter>)
+		{
+			// Status bitmaps hold live documents only
+			return status_documents_[static_cast<size_t>(documents_filter.status)].Contains(ordinal) &&
+				!documents_with_minus_words.Contains(ordinal);
+		}
+		else if constexpr (IsDocumentFilter<DocumentsFilter>::value)
+		{
+			return (single_status_documents != nullptr ? single_status_documents->Contains(ordinal) : !removed_documents_[ordinal]) &&
+				!documents_with_minus_words.Contains(ordinal) &&
+				documents_filter(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal]);
+		}
+		else
+		{
+			return !removed_documents_[ordinal] && !documents_with_minus_words.Contains(ordinal) &&
+				documents_filter(document_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal]);
+		}
+	};
+
+	// Terms no live document contains have only postings of removed documents and add nothing
+	const ScratchLease lease;
+	std::vector<TermId>& plus_terms = lease.Get().plus_terms;
+	std::vector<double>& idfs = lease.Get().idfs;
+	plus_terms.clear();
+	idfs.clear();
+	for (size_t term_index = 0; term_index < query_terms.plus_terms.size(); ++term_index)
+	{
+		if (idf_table_.GetDocumentFreq(query_terms.plus_terms[term_index]) > 0)
+		{
+			plus_terms.push_back(query_terms.plus_terms[term_index]);
+			idfs.push_back(query_terms.plus_idfs[term_index]);
+		}
+	}
+
+	// Appends to documents the candidates among the documents with ordinals in [first, last)
+	auto score_range = [&](DocumentOrdinal first, DocumentOrdinal last, std::vector<Document>& documents)
+	{
+		const ScratchLease range_lease;
+		SearchScratch& scratch = range_lease.Get();
+		TopDocumentCollector collector(top_count, scratch.top_relevances, scratch.candidates);
+		std::vector<TermPostings>& term_postings = scratch.term_postings;
+		term_postings.resize(plus_terms.size());
+		for (size_t index = first < write_first_ordinal_ ? FindSegmentIndex(first) : segments_.size();
+			index < segments_.size() && segments_[index]->GetFirstOrdinal() < last; ++index)
+		{
+			const IndexSegment& segment = *segments_[index];
+			std::transform(plus_terms.begin(), plus_terms.end(), term_postings.begin(),
+				[&segment](TermId term_id) { return segment.GetTermPostings(term_id); });
+			ScoreSegment(term_postings, idfs, std::max(first, segment.GetFirstOrdinal()), std::min(last, segment.GetLastOrdinal()),
+				is_accepted, collector, scratch);
+		}
+		if (last > write_first_ordinal_)
+		{
+			std::transform(plus_terms.begin(), plus_terms.end(), term_postings.begin(),
+				[this](TermId term_id) { return GetWriteTermPostings(term_id); });
+			ScoreSegment(term_postings, idfs, std::max(first, write_first_ordinal_), last, is_accepted, collector, scratch);
+		}
+		collector.Finish(documents);
+	};
+
+	bool constexpr is_parallel = IsParallelPolicy<ExecutionPolicy>::value;
+	if constexpr (!is_parallel)
 	{
-		matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+		score_range(0, ordinal_count, candidates);
 	}
+	else
+	{
+		// Every worker owns a disjoint ordinal range, so no scores are shared between threads
+		const size_t range_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()) * 4, std::max<DocumentOrdinal>(ordinal_count, 1));
+		const DocumentOrdinal range_size = static_cast<DocumentOrdinal>((ordinal_count + range_count - 1) / range_count);
+		std::vector<std::vector<Document>> range_documents(range_count);
+		std::vector<size_t> range_indexes(range_count);
+		std::iota(range_indexes.begin(), range_indexes.end(), 0);
 
-	return matched_documents;
+		std::for_each(policy, range_indexes.begin(), range_indexes.end(),
+			[&](size_t range_index)
+			{
+				const DocumentOrdinal first = static_cast<DocumentOrdinal>(std::min<size_t>(range_index * range_size, ordinal_count));
+				const DocumentOrdinal last = static_cast<DocumentOrdinal>(std::min<size_t>(first + range_size, ordinal_count));
+				score_range(first, last, range_documents[range_index]);
+			});
+
+		for (const std::vector<Document>& documents : range_documents)
+		{
+			candidates.insert(candidates.end(), documents.begin(), documents.end());
+		}
+	}
 }
 
 template <typename ExecutionPolicy>
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(ExecutionPolicy&& policy, std::string_view raw_query, int document_id) const
 {
-	using namespace std::string_view_literals;
+	const DocumentOrdinal ordinal = GetOrdinal(document_id);
+	return MatchDocumentImpl(policy, ParseQuery(raw_query, false), ordinal);
+}
+
+template <typename ExecutionPolicy>
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(ExecutionPolicy&& policy, const PreparedQuery& query, int document_id) const
+{
+	const DocumentOrdinal ordinal = GetOrdinal(document_id);
+	return MatchDocumentImpl(policy, *GetPreparedTerms(query), ordinal);
+}
+
+template <typename ExecutionPolicy>
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocumentImpl(ExecutionPolicy&& policy, const Query& query_terms, DocumentOrdinal ordinal) const
+{
+
+	auto term_checker = [this, ordinal](TermId term_id)
+	{
+		return HasPosting(term_id, ordinal);
+	};
+
+	if (std::any_of(policy, query_terms.minus_terms.begin(), query_terms.minus_terms.end(), term_checker))
+	{
+		return std::tuple{ std::vector<std::string_view>(), document_statuses_[ordinal] };
+	}
+
+	std::vector<TermId> matched_terms(query_terms.plus_terms.size());
+	auto terms_end = std::copy_if(policy, query_terms.plus_terms.begin(), query_terms.plus_terms.end(), matched_terms.begin(), term_checker);
+	std::sort(matched_terms.begin(), terms_end);
+	terms_end = std::unique(matched_terms.begin(), terms_end);
+
+	std::vector<std::string_view> matched_words(terms_end - matched_terms.begin());
+	std::transform(matched_terms.begin(), terms_end, matched_words.begin(),
+		[this](TermId term_id) { return terms_.GetTerm(term_id); });
+	std::sort(matched_words.begin(), matched_words.end());
+	return std::tuple{ matched_words, document_statuses_[ordinal] };
+}
+
+template <typename ExecutionPolicy>
+DocumentMatches SearchServer::MatchDocuments(ExecutionPolicy&& policy, std::string_view raw_query, const std::vector<int>& document_ids) const
+{
+	return MatchDocumentsImpl(policy, ParseQuery(raw_query), document_ids);
+}
 
-	Query query_words = ParseQuery(raw_query, false);
-	std::vector<std::string_view> matched_words(query_words.plus_words.size());
+template <typename ExecutionPolicy>
+DocumentMatches SearchServer::MatchDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, const std::vector<int>& document_ids) const
+{
+	return MatchDocumentsImpl(policy, *GetPreparedTerms(query), document_ids);
+}
+
+template <typename ExecutionPolicy>
+DocumentMatches SearchServer::MatchDocumentsImpl(ExecutionPolicy&& policy, const Query& query_terms, const std::vector<int>& document_ids) const
+{
+	// Plus terms in the order of their words, so that the words of every document come out sorted
+	std::vector<std::pair<std::string_view, TermId>> plus_words(query_terms.plus_terms.size());
+	std::transform(query_terms.plus_terms.begin(), query_terms.plus_terms.end(), plus_words.begin(),
+		[this](TermId term_id) { return std::pair{ terms_.GetTerm(term_id), term_id }; });
+	std::sort(plus_words.begin(), plus_words.end());
 
-	auto word_checker = [this, document_id](std::string_view word)
+	auto for_each_match = [this, &query_terms, &plus_words](DocumentOrdinal ordinal, auto visitor)
 	{
-		return (word_to_documents_freqs_.find(word) != word_to_documents_freqs_.end() &&
-			word_to_documents_freqs_.at(word).count(document_id));
+		const std::vector<TermCount>& term_counts = document_term_counts_[ordinal];
+		if (std::any_of(query_terms.minus_terms.begin(), query_terms.minus_terms.end(),
+			[&term_counts](TermId term_id) { return HasTerm(term_counts, term_id); }))
+		{
+			return;
+		}
+		for (const auto& [word, term_id] : plus_words)
+		{
+			if (HasTerm(term_counts, term_id))
+			{
+				visitor(word);
+			}
+		}
 	};
 
-	if (std::any_of(policy, query_words.minus_words.begin(), query_words.minus_words.end(), word_checker))
+	// Ordinals are resolved up front, so that a missing document throws outside of the parallel part
+	const size_t document_count = document_ids.size();
+	std::vector<DocumentOrdinal> ordinals(document_count);
+	DocumentMatches matches;
+	matches.statuses.resize(document_count);
+	for (size_t index = 0; index < document_count; ++index)
 	{
-		return std::tuple{ std::vector<std::string_view>(), documents_.at(document_id).status };
+		ordinals[index] = GetOrdinal(document_ids[index]);
+		matches.statuses[index] = document_statuses_[ordinals[index]];
 	}
 
-	auto words_end = std::copy_if(policy, query_words.plus_words.begin(), query_words.plus_words.end(), matched_words.begin(), word_checker);
+	bool constexpr is_parallel = IsParallelPolicy<ExecutionPolicy>::value;
+	if constexpr (!is_parallel)
+	{
+		matches.offsets.reserve(document_count + 1);
+		for (const DocumentOrdinal ordinal : ordinals)
+		{
+			for_each_match(ordinal, [&matches](std::string_view word) { matches.words.push_back(word); });
+			matches.offsets.push_back(matches.words.size());
+		}
+	}
+	else
+	{
+		// Documents are matched twice, first to count their words and then to write them at their offsets
+		matches.offsets.resize(document_count + 1);
+		std::transform(policy, ordinals.begin(), ordinals.end(), matches.offsets.begin() + 1,
+			[&for_each_match](DocumentOrdinal ordinal)
+			{
+				size_t count = 0;
+				for_each_match(ordinal, [&count](std::string_view) { ++count; });
+				return count;
+			});
+		std::inclusive_scan(matches.offsets.begin(), matches.offsets.end(), matches.offsets.begin());
+		matches.words.resize(matches.offsets.back());
+		std::vector<size_t> indexes(document_count);
+		std::iota(indexes.begin(), indexes.end(), 0);
+		std::for_each(policy, indexes.begin(), indexes.end(),
+			[&](size_t index)
+			{
+				std::string_view* output = matches.words.data() + matches.offsets[index];
+				for_each_match(ordinals[index], [&output](std::string_view word) { *output++ = word; });
+			});
+	}
+	return matches;
+}
 
-	matched_words.erase(remove(matched_words.begin(), matched_words.end(), ""sv), matched_words.end());
+template <typename Visitor>
+void SearchServer::ForEachPosting(TermId term_id, Visitor visitor) const
+{
+	for (const auto& segment : segments_)
+	{
+		for (PostingCursor cursor(segment->GetTermPostings(term_id)); !cursor.IsAtEnd(); cursor.Next())
+		{
+			visitor(cursor.GetOrdinal(), cursor.GetTermCount());
+		}
+	}
+	for (const Posting& posting : write_postings_[term_id])
+	{
+		visitor(posting.ordinal, posting.term_count);
+	}
+}
 
-	std::sort(matched_words.begin(), words_end);
-	words_end = unique(matched_words.begin(), words_end);
-	matched_words.erase(words_end, matched_words.end());
-	return std::tuple{ matched_words, documents_.at(document_id).status };
+template <typename Visitor>
+void SearchServer::ForEachDocumentTerm(int document_id, Visitor visitor) const
+{
+	for (const TermCount& term_count : document_term_counts_[GetOrdinal(document_id)])
+	{
+		visitor(term_count.term_id);
+	}
 }
 
 template <typename StringCollection>
@@ -0,0 +1,475 @@
+#include "search_server.h"
+#include "mapped_corpus.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+// Snapshot layout, all numbers in host byte order:
+//   header:  magic, format version, payload size, payload checksum
+//   payload: sections written by SaveSnapshot in a fixed order, every array is
+//            a uint64 element count followed by the raw elements
+namespace
+{
+	const char SNAPSHOT_MAGIC[8] = { 'S', 'S', 'R', 'V', 'S', 'N', 'A', 'P' };
+	const uint32_t SNAPSHOT_VERSION = 3;
+
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t payload_size;
+		uint64_t checksum;
+	};
+
+	// FNV-1a over 64-bit words, can be fed in pieces of any size
+	class SnapshotChecksum
+	{
+	public:
+		void Update(const char* data, size_t size)
+		{
+			total_size_ += size;
+			for (; size > 0 && word_bytes_ != 0; ++data, --size)
+			{
+				AddByte(*data);
+			}
+			for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t))
+			{
+				uint64_t word;
+				memcpy(&word, data, sizeof(word));
+				Mix(word);
+			}
+			for (; size > 0; ++data, --size)
+			{
+				AddByte(*data);
+			}
+		}
+
+		uint64_t Finish() const
+		{
+			uint64_t hash = hash_;
+			if (word_bytes_ != 0)
+			{
+				hash = (hash ^ word_) * FNV_PRIME;
+			}
+			return (hash ^ total_size_) * FNV_PRIME;
+		}
+
+	private:
+		static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+		uint64_t hash_ = 14695981039346656037ull;
+		uint64_t word_ = 0;
+		size_t word_bytes_ = 0;
+		uint64_t total_size_ = 0;
+
+		void Mix(uint64_t word)
+		{
+			hash_ = (hash_ ^ word) * FNV_PRIME;
+		}
+
+		void AddByte(char c)
+		{
+			word_ |= static_cast<uint64_t>(static_cast<unsigned char>(c)) << (8 * word_bytes_);
+			if (++word_bytes_ == sizeof(uint64_t))
+			{
+				Mix(word_);
+				word_ = 0;
+				word_bytes_ = 0;
+			}
+		}
+	};
+
+	class SnapshotWriter
+	{
+	public:
+		explicit SnapshotWriter(ostream& output)
+			: output_(output)
+		{
+		}
+
+		template <typename T>
+		void WriteValue(const T& value)
+		{
+			static_assert(is_trivially_copyable_v<T>);
+			Write(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		template <typename T>
+		void WriteArray(const vector<T>& values)
+		{
+			static_assert(is_trivially_copyable_v<T>);
+			WriteValue(static_cast<uint64_t>(values.size()));
+			Write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+		}
+
+		// Strings are stored as an array of lengths followed by their concatenation
+		template <typename StringCollection>
+		void WriteStrings(const StringCollection& strings)
+		{
+			vector<uint32_t> lengths;
+			vector<char> blob;
+			for (string_view str : strings)
+			{
+				lengths.push_back(static_cast<uint32_t>(str.size()));
+				blob.insert(blob.end(), str.begin(), str.end());
+			}
+			WriteArray(lengths);
+			WriteArray(blob);
+		}
+
+		uint64_t GetSize() const
+		{
+			return size_;
+		}
+
+		uint64_t GetChecksum() const
+		{
+			return checksum_.Finish();
+		}
+
+	private:
+		ostream& output_;
+		SnapshotChecksum checksum_;
+		uint64_t size_ = 0;
+
+		void Write(const char* data, size_t size)
+		{
+			output_.write(data, size);
+			checksum_.Update(data, size);
+			size_ += size;
+		}
+	};
+
+	class SnapshotReader
+	{
+	public:
+		explicit SnapshotReader(string_view data)
+			: data_(data)
+		{
+		}
+
+		template <typename T>
+		T ReadValue()
+		{
+			static_assert(is_trivially_copyable_v<T>);
+			T value;
+			memcpy(&value, Take(sizeof(T)), sizeof(T));
+			return value;
+		}
+
+		template <typename T>
+		vector<T> ReadArray()
+		{
+			static_assert(is_trivially_copyable_v<T>);
+			const uint64_t count = ReadValue<uint64_t>();
+			if (count > data_.size() / sizeof(T))
+			{
+				throw invalid_argument("corrupted snapshot");
+			}
+			vector<T> values(count);
+			// An empty vector may have a null data pointer, which memcpy does not accept
+			if (count > 0)
+			{
+				memcpy(values.data(), Take(count * sizeof(T)), count * sizeof(T));
+			}
+			return values;
+		}
+
+		// Views point into the snapshot data
+		vector<string_view> ReadStrings()
+		{
+			const vector<uint32_t> lengths = ReadArray<uint32_t>();
+			const uint64_t blob_size = ReadValue<uint64_t>();
+			const char* blob = Take(blob_size);
+			vector<string_view> strings;
+			strings.reserve(lengths.size());
+			uint64_t offset = 0;
+			for (const uint32_t length : lengths)
+			{
+				if (offset + length > blob_size)
+				{
+					throw invalid_argument("corrupted snapshot");
+				}
+				strings.emplace_back(blob + offset, length);
+				offset += length;
+			}
+			return strings;
+		}
+
+		bool IsAtEnd() const
+		{
+			return data_.empty();
+		}
+
+	private:
+		string_view data_;
+
+		const char* Take(uint64_t size)
+		{
+			if (size > data_.size())
+			{
+				throw invalid_argument("corrupted snapshot");
+			}
+			const char* data = data_.data();
+			data_.remove_prefix(size);
+			return data;
+		}
+	};
+
+	// Offsets of a flattened array of arrays have to cover all values in order
+	void CheckOffsets(const vector<uint64_t>& offsets, size_t range_count, size_t value_count)
+	{
+		if (offsets.size() != range_count + 1 || offsets.front() != 0 || offsets.back() != value_count ||
+			!is_sorted(offsets.begin(), offsets.end()))
+		{
+			throw invalid_argument("corrupted snapshot");
+		}
+	}
+}
+
+void SearchServer::SaveSnapshot(const string& path) const
+{
+	ofstream output(path, ios::binary | ios::trunc);
+	if (!output)
+	{
+		throw runtime_error("cannot open file: "s + path);
+	}
+	SnapshotHeader header{};
+	output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	SnapshotWriter writer(output);
+	writer.WriteValue(static_cast<uint64_t>(max_result_document_count_));
+	writer.WriteStrings(stop_words_);
+
+	vector<string_view> terms(terms_.GetTermCount());
+	for (TermId term_id = 0; term_id < terms.size(); ++term_id)
+	{
+		terms[term_id] = terms_.GetTerm(term_id);
+	}
+	writer.WriteStrings(terms);
+
+	vector<uint8_t> document_alive(document_ids_.size());
+	for (const auto [document_id, ordinal] : document_ordinals_)
+	{
+		document_alive[ordinal] = true;
+	}
+	writer.WriteArray(document_ids_);
+	writer.WriteArray(document_ratings_);
+	writer.WriteArray(document_statuses_);
+	writer.WriteArray(document_sizes_);
+	writer.WriteArray(document_alive);
+
+	// Segments are saved as their compressed arrays, the write segment is compressed into one more.
+	// Postings of removed documents stay in them, their documents are saved as removed
+	vector<shared_ptr<const IndexSegment>> segments = segments_;
+	if (write_first_ordinal_ < document_ids_.size())
+	{
+		vector<TermId> write_terms = write_terms_;
+		sort(write_terms.begin(), write_terms.end());
+		vector<uint64_t> write_offsets{ 0 };
+		vector<Posting> write_postings;
+		for (const TermId term_id : write_terms)
+		{
+			write_postings.insert(write_postings.end(), write_postings_[term_id].begin(), write_postings_[term_id].end());
+			write_offsets.push_back(write_postings.size());
+		}
+		segments.push_back(make_shared<const IndexSegment>(write_first_ordinal_, static_cast<DocumentOrdinal>(document_ids_.size()),
+			write_terms, write_offsets, write_postings,
+			vector<uint32_t>(document_sizes_.begin() + write_first_ordinal_, document_sizes_.end())));
+	}
+	writer.WriteValue(static_cast<uint64_t>(segments.size()));
+	for (const auto& segment : segments)
+	{
+		writer.WriteValue(segment->GetFirstOrdinal());
+		writer.WriteValue(segment->GetLastOrdinal());
+		writer.WriteArray(segment->GetTerms());
+		writer.WriteArray(segment->GetMaxTermFreqs());
+		writer.WriteArray(segment->GetBlockOffsets());
+		writer.WriteArray(segment->GetBlocks());
+		writer.WriteArray(segment->GetBlockData());
+	}
+
+	vector<uint64_t> forward_offsets{ 0 };
+	vector<TermId> forward_terms;
+	vector<uint32_t> forward_counts;
+	for (const vector<TermCount>& term_counts : document_term_counts_)
+	{
+		for (const auto [term_id, count] : term_counts)
+		{
+			forward_terms.push_back(term_id);
+			forward_counts.push_back(count);
+		}
+		forward_offsets.push_back(forward_terms.size());
+	}
+	writer.WriteArray(forward_offsets);
+	writer.WriteArray(forward_terms);
+	writer.WriteArray(forward_counts);
+
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.payload_size = writer.GetSize();
+	header.checksum = writer.GetChecksum();
+	output.seekp(0);
+	output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!output.flush())
+	{
+		throw runtime_error("cannot write file: "s + path);
+	}
+}
+
+SearchServer SearchServer::LoadSnapshot(const string& path)
+{
+	const MappedFile file(path);
+	const string_view data = file.GetData();
+
+	SnapshotHeader header;
+	if (data.size() < sizeof(header))
+	{
+		throw invalid_argument("invalid snapshot");
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	const string_view payload = data.substr(sizeof(header));
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION)
+	{
+		throw invalid_argument("invalid snapshot");
+	}
+	SnapshotChecksum checksum;
+	checksum.Update(payload.data(), payload.size());
+	if (header.payload_size != payload.size() || header.checksum != checksum.Finish())
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+
+	SnapshotReader reader(payload);
+	SearchServer server;
+	server.max_result_document_count_ = reader.ReadValue<uint64_t>();
+	for (const string_view stop_word : reader.ReadStrings())
+	{
+		server.stop_words_.emplace(stop_word);
+	}
+	const vector<string_view> terms = reader.ReadStrings();
+	for (const string_view term : terms)
+	{
+		server.terms_.Intern(term);
+	}
+	// A repeated term would shift the ids of all terms after it
+	if (server.terms_.GetTermCount() != terms.size())
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+
+	server.document_ids_ = reader.ReadArray<int>();
+	server.document_ratings_ = reader.ReadArray<int>();
+	server.document_statuses_ = reader.ReadArray<DocumentStatus>();
+	server.document_sizes_ = reader.ReadArray<uint32_t>();
+	const vector<uint8_t> document_alive = reader.ReadArray<uint8_t>();
+	const size_t ordinal_count = server.document_ids_.size();
+	if (server.document_ratings_.size() != ordinal_count || server.document_statuses_.size() != ordinal_count ||
+		server.document_sizes_.size() != ordinal_count || document_alive.size() != ordinal_count ||
+		any_of(server.document_statuses_.begin(), server.document_statuses_.end(),
+			[](DocumentStatus status) { return static_cast<size_t>(status) >= DOCUMENT_STATUS_COUNT; }))
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+	server.removed_documents_.resize(ordinal_count);
+	for (DocumentOrdinal ordinal = 0; ordinal < ordinal_count; ++ordinal)
+	{
+		server.removed_documents_[ordinal] = !document_alive[ordinal];
+		if (document_alive[ordinal])
+		{
+			if (!server.document_ordinals_.emplace(server.document_ids_[ordinal], ordinal).second)
+			{
+				throw invalid_argument("corrupted snapshot");
+			}
+			server.docs_ids_.insert(server.document_ids_[ordinal]);
+			server.status_documents_[static_cast<size_t>(server.document_statuses_[ordinal])].Add(ordinal);
+		}
+	}
+
+	const size_t term_count = server.terms_.GetTermCount();
+	const uint64_t segment_count = reader.ReadValue<uint64_t>();
+	if (segment_count > ordinal_count)
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+	// Segments have to cover all ordinals in order
+	DocumentOrdinal segment_first = 0;
+	server.segments_.reserve(segment_count);
+	for (uint64_t index = 0; index < segment_count; ++index)
+	{
+		const DocumentOrdinal first_ordinal = reader.ReadValue<DocumentOrdinal>();
+		const DocumentOrdinal last_ordinal = reader.ReadValue<DocumentOrdinal>();
+		vector<TermId> segment_terms = reader.ReadArray<TermId>();
+		vector<double> max_term_freqs = reader.ReadArray<double>();
+		vector<uint64_t> block_offsets = reader.ReadArray<uint64_t>();
+		vector<PostingBlock> blocks = reader.ReadArray<PostingBlock>();
+		vector<uint32_t> block_data = reader.ReadArray<uint32_t>();
+		if (first_ordinal != segment_first || last_ordinal <= first_ordinal || last_ordinal > ordinal_count ||
+			(!segment_terms.empty() && segment_terms.back() >= term_count))
+		{
+			throw invalid_argument("corrupted snapshot");
+		}
+		try
+		{
+			server.segments_.push_back(make_shared<const IndexSegment>(first_ordinal, last_ordinal, move(segment_terms),
+				move(max_term_freqs), move(block_offsets), move(blocks), move(block_data),
+				vector<uint32_t>(server.document_sizes_.begin() + first_ordinal, server.document_sizes_.begin() + last_ordinal)));
+		}
+		catch (const invalid_argument&)
+		{
+			throw invalid_argument("corrupted snapshot");
+		}
+		segment_first = last_ordinal;
+	}
+	if (segment_first != ordinal_count)
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+	server.write_postings_.resize(term_count);
+	server.write_first_ordinal_ = static_cast<DocumentOrdinal>(ordinal_count);
+
+	const vector<uint64_t> forward_offsets = reader.ReadArray<uint64_t>();
+	const vector<TermId> forward_terms = reader.ReadArray<TermId>();
+	const vector<uint32_t> forward_counts = reader.ReadArray<uint32_t>();
+	CheckOffsets(forward_offsets, ordinal_count, forward_terms.size());
+	if (forward_counts.size() != forward_terms.size() ||
+		any_of(forward_terms.begin(), forward_terms.end(), [term_count](TermId term_id) { return term_id >= term_count; }))
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+	server.document_term_counts_.resize(ordinal_count);
+	for (DocumentOrdinal ordinal = 0; ordinal < ordinal_count; ++ordinal)
+	{
+		vector<TermCount>& term_counts = server.document_term_counts_[ordinal];
+		term_counts.reserve(forward_offsets[ordinal + 1] - forward_offsets[ordinal]);
+		for (uint64_t index = forward_offsets[ordinal]; index < forward_offsets[ordinal + 1]; ++index)
+		{
+			term_counts.push_back({ forward_terms[index], forward_counts[index] });
+		}
+	}
+	// Term lists of removed documents are empty, so this counts the live documents of every term
+	server.idf_table_.SetTermCount(term_count);
+	server.idf_table_.SetDocumentCount(server.document_ordinals_.size());
+	vector<uint32_t> document_freqs(term_count);
+	for (const TermId term_id : forward_terms)
+	{
+		++document_freqs[term_id];
+	}
+	for (TermId term_id = 0; term_id < term_count; ++term_id)
+	{
+		server.idf_table_.AddDocuments(term_id, document_freqs[term_id]);
+	}
+
+	if (!reader.IsAtEnd())
+	{
+		throw invalid_argument("corrupted snapshot");
+	}
+	return server;
+}
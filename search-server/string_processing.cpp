@@ -1,7 +1,184 @@
 #include "string_processing.h"
 
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STRING_PROCESSING_SSE2
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STRING_PROCESSING_AVX2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace std;
 
+namespace
+{
+	const size_t SCAN_BLOCK_SIZE = 64;
+
+	// Bit i is set if byte i of the block is a space or a control character
+	struct BlockMasks
+	{
+		uint64_t spaces;
+		uint64_t controls;
+	};
+
+	size_t CountTrailingZeros(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return index;
+#else
+		return __builtin_ctzll(value);
+#endif
+	}
+
+	struct ScalarScanner
+	{
+		BlockMasks operator()(const char* block) const
+		{
+			BlockMasks masks{ 0, 0 };
+			for (size_t index = 0; index < SCAN_BLOCK_SIZE; ++index)
+			{
+				masks.spaces |= static_cast<uint64_t>(block[index] == ' ') << index;
+				masks.controls |= static_cast<uint64_t>(static_cast<unsigned char>(block[index]) < ' ') << index;
+			}
+			return masks;
+		}
+	};
+
+#ifdef STRING_PROCESSING_SSE2
+	struct Sse2Scanner
+	{
+		BlockMasks operator()(const char* block) const
+		{
+			const __m128i spaces = _mm_set1_epi8(' ');
+			const __m128i minus_one = _mm_set1_epi8(-1);
+			BlockMasks masks{ 0, 0 };
+			for (size_t offset = 0; offset < SCAN_BLOCK_SIZE; offset += 16)
+			{
+				const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + offset));
+				const __m128i controls = _mm_and_si128(_mm_cmplt_epi8(bytes, spaces), _mm_cmpgt_epi8(bytes, minus_one));
+				masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces)))) << offset;
+				masks.controls |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(controls))) << offset;
+			}
+			return masks;
+		}
+	};
+#endif
+
+#ifdef STRING_PROCESSING_AVX2
+	struct Avx2Scanner
+	{
+		__attribute__((target("avx2"))) BlockMasks operator()(const char* block) const
+		{
+			const __m256i spaces = _mm256_set1_epi8(' ');
+			const __m256i minus_one = _mm256_set1_epi8(-1);
+			BlockMasks masks{ 0, 0 };
+			for (size_t offset = 0; offset < SCAN_BLOCK_SIZE; offset += 32)
+			{
+				const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + offset));
+				const __m256i controls = _mm256_andnot_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(' ' - 1)), _mm256_cmpgt_epi8(bytes, minus_one));
+				masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, spaces)))) << offset;
+				masks.controls |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(controls))) << offset;
+			}
+			return masks;
+		}
+	};
+#endif
+
+	// Words start and end where a space borders a non-space, so the edges of the non-space mask
+	// alternate between word beginnings and word ends
+	template <typename Scanner>
+#if defined(__GNUC__) || defined(__clang__)
+	__attribute__((always_inline))
+#endif
+	inline bool SplitWithScanner(string_view text, vector<string_view>& words, Scanner scanner)
+	{
+		const char* data = text.data();
+		uint64_t controls = 0;
+		uint64_t previous_in_word = 0;
+		bool in_word = false;
+		size_t word_begin = 0;
+		char tail[SCAN_BLOCK_SIZE];
+		for (size_t block_begin = 0; block_begin < text.size(); block_begin += SCAN_BLOCK_SIZE)
+		{
+			const char* block = data + block_begin;
+			if (text.size() - block_begin < SCAN_BLOCK_SIZE)
+			{
+				// Padding with spaces ends the last word at the end of the text
+				memset(tail, ' ', SCAN_BLOCK_SIZE);
+				memcpy(tail, block, text.size() - block_begin);
+				block = tail;
+			}
+			const BlockMasks masks = scanner(block);
+			controls |= masks.controls;
+			const uint64_t in_word_mask = ~masks.spaces;
+			uint64_t edges = in_word_mask ^ ((in_word_mask << 1) | previous_in_word);
+			previous_in_word = in_word_mask >> (SCAN_BLOCK_SIZE - 1);
+			for (; edges != 0; edges &= edges - 1)
+			{
+				const size_t position = block_begin + CountTrailingZeros(edges);
+				if (in_word)
+				{
+					words.emplace_back(data + word_begin, position - word_begin);
+				}
+				word_begin = position;
+				in_word = !in_word;
+			}
+		}
+		if (in_word)
+		{
+			words.emplace_back(data + word_begin, text.size() - word_begin);
+		}
+		return controls == 0;
+	}
+
+	using SplitFunction = bool (*)(string_view, vector<string_view>&);
+
+#ifndef STRING_PROCESSING_SSE2
+	bool SplitScalar(string_view text, vector<string_view>& words)
+	{
+		return SplitWithScanner(text, words, ScalarScanner());
+	}
+#else
+	bool SplitSse2(string_view text, vector<string_view>& words)
+	{
+		return SplitWithScanner(text, words, Sse2Scanner());
+	}
+#endif
+
+#ifdef STRING_PROCESSING_AVX2
+	__attribute__((target("avx2"))) bool SplitAvx2(string_view text, vector<string_view>& words)
+	{
+		return SplitWithScanner(text, words, Avx2Scanner());
+	}
+#endif
+
+	SplitFunction SelectSplitFunction()
+	{
+#ifdef STRING_PROCESSING_AVX2
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return SplitAvx2;
+		}
+#endif
+#ifdef STRING_PROCESSING_SSE2
+		return SplitSse2;
+#else
+		return SplitScalar;
+#endif
+	}
+}
+
 vector<string> SplitIntoWords(const string& text)
 {
 	vector<string> words;
@@ -31,21 +208,13 @@ vector<string> SplitIntoWords(const string& text)
 
 vector<string_view> SplitIntoWordsView(string_view text)
 {
-    vector<string_view> result;
-    const int64_t pos_end = text.npos;
-    while (true)
-    {
-        int64_t space = text.find(' ', 0);
-        string_view word = space == pos_end ? text.substr(0) : text.substr(0, space);
-        if (!word.empty())
-        {
-            result.push_back(word);
-        }
-        if (space == pos_end)
-        {
-            break;
-        }
-        text.remove_prefix(space + 1);
-    }
-    return result;
+	vector<string_view> words;
+	SplitIntoWordsChecked(text, words);
+	return words;
+}
+
+bool SplitIntoWordsChecked(string_view text, vector<string_view>& words)
+{
+	static const SplitFunction split = SelectSplitFunction();
+	return split(text, words);
 }
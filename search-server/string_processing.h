@@ -7,3 +7,8 @@
 std::vector<std::string> SplitIntoWords(const std::string& text);
 
 std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
+
+// Appends the words of text separated by spaces to words, so that a caller can reuse its capacity.
+// Returns false if text contains a control character, the words are appended anyway.
+// Scans 64 bytes at a time with AVX2 or SSE2, picked at run time, or with a scalar loop
+bool SplitIntoWordsChecked(std::string_view text, std::vector<std::string_view>& words);
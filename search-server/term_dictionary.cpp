@@ -0,0 +1,51 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+
+using namespace std;
+
+TermId TermDictionary::Intern(string_view word)
+{
+	const auto it = term_to_id_.find(word);
+	if (it != term_to_id_.end())
+	{
+		return it->second;
+	}
+	const TermId term_id = static_cast<TermId>(id_to_term_.size());
+	const string_view stored_word = Store(word);
+	term_to_id_.emplace(stored_word, term_id);
+	id_to_term_.push_back(stored_word);
+	return term_id;
+}
+
+TermId TermDictionary::Find(string_view word) const
+{
+	const auto it = term_to_id_.find(word);
+	return it == term_to_id_.end() ? NO_TERM : it->second;
+}
+
+string_view TermDictionary::GetTerm(TermId term_id) const
+{
+	return id_to_term_[term_id];
+}
+
+size_t TermDictionary::GetTermCount() const
+{
+	return id_to_term_.size();
+}
+
+string_view TermDictionary::Store(string_view word)
+{
+	if (word.size() > block_free_)
+	{
+		const size_t block_size = max(BLOCK_SIZE, word.size());
+		blocks_.push_back(make_unique<char[]>(block_size));
+		block_pos_ = blocks_.back().get();
+		block_free_ = block_size;
+	}
+	char* stored = block_pos_;
+	copy(word.begin(), word.end(), stored);
+	block_pos_ += word.size();
+	block_free_ -= word.size();
+	return { stored, word.size() };
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using TermId = uint32_t;
+
+// Interns every distinct word once in an append-only arena and maps it to a dense TermId.
+// Views returned by GetTerm stay valid for the whole lifetime of the dictionary.
+class TermDictionary
+{
+public:
+	static constexpr TermId NO_TERM = std::numeric_limits<TermId>::max();
+
+	TermId Intern(std::string_view word);
+
+	TermId Find(std::string_view word) const;
+
+	std::string_view GetTerm(TermId term_id) const;
+
+	size_t GetTermCount() const;
+
+private:
+	static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	size_t block_free_ = 0;
+	char* block_pos_ = nullptr;
+
+	std::unordered_map<std::string_view, TermId> term_to_id_;
+	std::vector<std::string_view> id_to_term_;
+
+	std::string_view Store(std::string_view word);
+};